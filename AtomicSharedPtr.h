@@ -0,0 +1,222 @@
+#ifndef ATOMIC_SHARED_PTR_H
+#define ATOMIC_SHARED_PTR_H
+
+#include "SharedPtr.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+/* A SharedPtr slot that many threads can load, store, exchange and compare-exchange at the same time, for values
+* like config and routing tables that are read everywhere and swapped rarely.
+*
+* Split reference counting keeps every operation lock-free on x86-64. The stored SharedPtr lives in an immutable
+* Node, and the slot is a single 64 bit word packing the Node address (low 48 bits) with an external count (high
+* 16 bits) of readers currently between pinning the node and copying its value. A reader pins the node by bumping
+* the external count in the same CAS that reads the address, so the node cannot be freed before it copies the
+* SharedPtr out, then unpins by decrementing the external count again. When a writer swaps the node out, it moves
+* whatever external count was left into the node's internal count, and late readers decrement that instead; whoever
+* brings the internal count to zero deletes the node. Each store allocates one Node, loads never allocate.
+*/
+template <typename T>
+class AtomicSharedPtr {
+    private:
+        struct Node {
+            SharedPtr<T> value;
+            //readers that pinned the node before it was swapped out and have not let go yet, tracked negatively
+            //until the swapper adds the external count it took out of the slot
+            std::atomic<std::int64_t> internal;
+
+            explicit Node(SharedPtr<T>&& value) : value(std::move(value)), internal(0) {}
+        };
+
+        static constexpr int countShift = 48;
+        static constexpr std::uint64_t countOne = std::uint64_t(1) << countShift;
+        static constexpr std::uint64_t pointerMask = countOne - 1;
+
+        //loads pin and unpin through the word, so it changes even in const member functions
+        mutable std::atomic<std::uint64_t> word;
+
+        static Node* nodeOf(std::uint64_t value) {
+            return reinterpret_cast<Node*>(static_cast<std::uintptr_t>(value & pointerMask));
+        }
+        static std::uint64_t externalCount(std::uint64_t value) {
+            return value >> countShift;
+        }
+        static std::uint64_t pack(Node* node) {
+            std::uint64_t value = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(node));
+            //user space addresses on x86-64 fit in 48 bits, the top 16 are free for the external count
+            assert((value & ~pointerMask) == 0);
+            return value;
+        }
+
+        //empty SharedPtrs are stored as a null word, so clearing the slot never allocates
+        static Node* makeNode(SharedPtr<T>&& desired) {
+            if (desired.getCount() == 0 && desired.get() == nullptr) {
+                return nullptr;
+            }
+            return new Node(std::move(desired));
+        }
+
+        //pin the current node by bumping the external count, so it stays alive until unpin()
+        Node* pin() const {
+            std::uint64_t cur = this->word.load(std::memory_order_relaxed);
+            while (true) {
+                Node* node = nodeOf(cur);
+                if (node == nullptr) {
+                    return nullptr;
+                }
+                if (externalCount(cur) == (std::uint64_t(1) << (64 - countShift)) - 1) {
+                    //external count saturated by other readers, wait for some of them to unpin
+                    std::this_thread::yield();
+                    cur = this->word.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (this->word.compare_exchange_weak(cur, cur + countOne, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return node;
+                }
+                detail::noteCasRetry();
+            }
+        }
+
+        //drop a pin taken by pin(), either from the slot if the node is still installed or from the node itself
+        void unpin(Node* node) const {
+            std::uint64_t cur = this->word.load(std::memory_order_relaxed);
+            while (nodeOf(cur) == node) {
+                if (this->word.compare_exchange_weak(cur, cur - countOne, std::memory_order_release, std::memory_order_relaxed)) {
+                    return;
+                }
+                detail::noteCasRetry();
+            }
+            //the node was swapped out and our pin was moved into its internal count
+            if (node->internal.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete node;
+            }
+        }
+
+        /* Hand a node that was just swapped out of the slot over to its remaining readers. external is the count that
+        * was in the word, held is how many of those pins belong to the caller and are dropped here.
+        */
+        static void retire(Node* node, std::uint64_t external, std::uint64_t held) {
+            std::int64_t outstanding = static_cast<std::int64_t>(external - held);
+            if (node->internal.fetch_add(outstanding, std::memory_order_acq_rel) + outstanding == 0) {
+                delete node;
+            }
+        }
+
+        static bool sameValue(const SharedPtr<T>& a, const SharedPtr<T>& b) {
+            return a.get() == b.get() && a.block == b.block;
+        }
+
+    public:
+        //default constructor, holds an empty SharedPtr
+        constexpr AtomicSharedPtr() noexcept : word(0) {}
+        //constructor with an initial value
+        AtomicSharedPtr(SharedPtr<T> desired) : word(pack(makeNode(std::move(desired)))) {}
+
+        AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+        AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+        //destructor, no other thread may be using the slot anymore
+        ~AtomicSharedPtr() {
+            std::uint64_t cur = this->word.load(std::memory_order_acquire);
+            if (nodeOf(cur) != nullptr) {
+                retire(nodeOf(cur), externalCount(cur), 0);
+            }
+        }
+
+        //true when every operation is lock-free, which holds wherever 64 bit atomics are
+        bool is_lock_free() const noexcept {
+            return this->word.is_lock_free();
+        }
+
+        //get a counted copy of the current value
+        SharedPtr<T> load() const {
+            Node* node = pin();
+            if (node == nullptr) {
+                return SharedPtr<T>();
+            }
+            SharedPtr<T> result(node->value);
+            unpin(node);
+            detail::collectCasRetries<T>();
+            return result;
+        }
+        operator SharedPtr<T>() const {
+            return load();
+        }
+
+        //replace the value, the previous one is released once no reader is still copying it
+        void store(SharedPtr<T> desired) {
+            exchange(std::move(desired));
+        }
+        AtomicSharedPtr& operator=(SharedPtr<T> desired) {
+            store(std::move(desired));
+            return *this;
+        }
+
+        //replace the value and return the previous one
+        SharedPtr<T> exchange(SharedPtr<T> desired) {
+            std::uint64_t old = this->word.exchange(pack(makeNode(std::move(desired))), std::memory_order_acq_rel);
+            Node* node = nodeOf(old);
+            if (node == nullptr) {
+                return SharedPtr<T>();
+            }
+            if (externalCount(old) == 0) {
+                //no reader had it pinned, so nobody else can reach the node anymore
+                SharedPtr<T> result(std::move(node->value));
+                delete node;
+                return result;
+            }
+            SharedPtr<T> result(node->value);
+            retire(node, externalCount(old), 0);
+            return result;
+        }
+
+        /* Replace the value with desired only if it still holds the same pointer and shares ownership with expected.
+        * On failure expected is updated to the current value. Loads never make it fail spuriously, a reader pinning
+        * the node just makes the swap retry.
+        */
+        bool compare_exchange_strong(SharedPtr<T>& expected, SharedPtr<T> desired) {
+            Node* replacement = makeNode(std::move(desired));
+            while (true) {
+                //pin the node so its value can be compared without racing a concurrent delete
+                Node* node = pin();
+                if (node == nullptr) {
+                    if (expected.getCount() != 0 || expected.get() != nullptr) {
+                        delete replacement;
+                        expected = SharedPtr<T>();
+                        return false;
+                    }
+                    std::uint64_t empty = 0;
+                    if (this->word.compare_exchange_strong(empty, pack(replacement), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                        return true;
+                    }
+                    detail::noteCasRetry();
+                    continue;
+                }
+
+                if (!sameValue(node->value, expected)) {
+                    expected = node->value;
+                    unpin(node);
+                    delete replacement;
+                    return false;
+                }
+                std::uint64_t cur = this->word.load(std::memory_order_relaxed);
+                while (nodeOf(cur) == node) {
+                    if (this->word.compare_exchange_weak(cur, pack(replacement), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                        retire(node, externalCount(cur), 1);
+                        return true;
+                    }
+                    detail::noteCasRetry();
+                }
+                //someone else swapped the node out first, drop our pin and compare against the new value
+                unpin(node);
+            }
+        }
+        bool compare_exchange_weak(SharedPtr<T>& expected, SharedPtr<T> desired) {
+            return compare_exchange_strong(expected, std::move(desired));
+        }
+};
+
+#endif // ATOMIC_SHARED_PTR_H
@@ -0,0 +1,305 @@
+#ifndef BIASED_POLICY_H
+#define BIASED_POLICY_H
+
+#include "SharedPtr.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+/* Biased reference counting, for objects that are mostly copied and released on the thread that created them, with
+* only a few handles escaping to other threads: SharedPtr<T, Biased>.
+*
+* Every count is biased towards its creating thread, the owner. The owner counts its references in a plain local
+* count, which only it ever writes, so its copies and releases are an ordinary load and store with no atomic RMW.
+* Other threads count theirs on an atomic shared count. When the owner's local count drops to zero the two are
+* merged: the owner sets a merged flag on the shared count, and from then on every thread, the owner included, counts
+* on the shared count alone and whoever brings it to zero destroys the object.
+*
+* Before the merge, the shared count never goes negative. A release on another thread that finds it at zero is
+* releasing a reference the owner counted locally, so it hands that release over to the owner instead: the count is
+* queued on the owner's pending list and the owner merges it and applies the release later. The owner works through
+* its pending list on its next non-final biased release, when it calls Biased::processPending(), and when it exits,
+* at which point it also merges every count still biased to it, so nothing stays biased to a dead thread. Until
+* then an object whose last reference was handed over stays alive, which is the price of never touching the owner's
+* local count from another thread.
+*
+* A count must be the first member of a ControlBlock<Biased>, so a queued release can find its block.
+*/
+struct Biased {
+    class Count;
+
+    //apply the releases other threads handed to the calling thread, freeing objects they leave without owners
+    static void processPending();
+
+    //observers are rare and not tied to a thread, a plain atomic count is enough
+    typedef MultiThreaded::Count WeakCount;
+
+    private:
+        //per-thread record every count biased to that thread points to
+        struct Owner {
+            std::mutex mtx;
+            //releases handed over by other threads, each entry carries one reference (guarded by mtx)
+            std::vector<Count*> pending;
+            //lets the owner check for handed over releases without taking the mutex
+            std::atomic<bool> hasPending;
+            //false once the thread has exited and merged every count biased to it (guarded by mtx)
+            bool alive;
+            //unmerged counts biased to this thread, linked through the counts, only touched by the owner
+            Count* biased;
+            //one for the thread plus one per count that names this owner, other threads may still queue on it
+            std::atomic<std::size_t> refs;
+
+            Owner() : hasPending(false), alive(true), biased(nullptr), refs(1) {}
+
+            void unref() {
+                if (this->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    delete this;
+                }
+            }
+        };
+
+        //trivially destructible so it stays readable while other thread_local destructors release handles
+        struct ThreadState {
+            Owner* owner;
+            bool exited;
+        };
+
+        //merges everything still biased to the thread when it exits
+        struct OwnerExit {
+            ~OwnerExit() {
+                Biased::retireOwner();
+            }
+        };
+
+        static ThreadState& threadState() {
+            thread_local ThreadState state = {nullptr, false};
+            return state;
+        }
+
+        //the calling thread's record, created on first use, null once the thread is exiting
+        static Owner* ownerForNewCount() {
+            ThreadState& state = threadState();
+            if (state.owner == nullptr && !state.exited) {
+                state.owner = new Owner();
+                thread_local OwnerExit guard;
+                (void)guard;
+            }
+            return state.owner;
+        }
+
+        static void retireOwner();
+
+        //the last owner of a queued count is gone, finish the release on its control block
+        static void finishRelease(Count* count);
+};
+
+class Biased::Count {
+    private:
+        static constexpr std::uint64_t mergedFlag = std::uint64_t(1) << 63;
+
+        //owner's references while unmerged, only the owner writes it, atomic so load() may read it from anywhere
+        std::atomic<unsigned int> local;
+        //owner's view of the merged flag, only the owner (or its exit) writes it, always true without an owner
+        bool merged;
+        Owner* owner;
+        Count* prev;
+        Count* next;
+        //other threads' references, plus mergedFlag once the local count has been folded in
+        std::atomic<std::uint64_t> shared;
+
+        //the fast path, reading merged is safe because only the owner writes it and only the owner gets past the first check
+        bool biasedHere() const {
+            return this->owner == threadState().owner && !this->merged;
+        }
+
+        void unlink() {
+            if (this->prev != nullptr) {
+                this->prev->next = this->next;
+            } else {
+                this->owner->biased = this->next;
+            }
+            if (this->next != nullptr) {
+                this->next->prev = this->prev;
+            }
+        }
+
+        //fold the local count into the shared count for good, only called by the owner or its exit, returns the old shared count
+        std::uint64_t merge() {
+            unsigned int moved = this->local.load(std::memory_order_relaxed);
+            std::uint64_t old = this->shared.fetch_add(mergedFlag + moved, std::memory_order_acq_rel);
+            this->local.store(0, std::memory_order_relaxed);
+            this->merged = true;
+            unlink();
+            return old;
+        }
+
+        //false if the owner already exited, in which case the count has been merged
+        bool handOver() {
+            std::lock_guard<std::mutex> guard(this->owner->mtx);
+            if (!this->owner->alive) {
+                return false;
+            }
+            this->owner->pending.push_back(this);
+            this->owner->hasPending.store(true, std::memory_order_relaxed);
+            return true;
+        }
+
+        bool releaseShared() {
+            std::uint64_t cur = this->shared.load(std::memory_order_relaxed);
+            while (true) {
+                if (cur & mergedFlag) {
+                    return this->shared.fetch_sub(1, std::memory_order_acq_rel) == (mergedFlag | 1);
+                }
+                if (cur != 0) {
+                    //the owner still holds local references, so this cannot be the last one
+                    if (this->shared.compare_exchange_weak(cur, cur - 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                        return false;
+                    }
+                    detail::noteCasRetry();
+                    continue;
+                }
+                //this reference was counted on the owner's local count, only the owner may take it off
+                if (handOver()) {
+                    return false;
+                }
+                cur = this->shared.load(std::memory_order_relaxed);
+            }
+        }
+
+        friend struct Biased;
+
+    public:
+        explicit Count(unsigned int value) : local(value), merged(false), owner(ownerForNewCount()), prev(nullptr), next(nullptr), shared(0) {
+            if (this->owner == nullptr) {
+                //created while the thread is exiting, start out merged
+                this->local.store(0, std::memory_order_relaxed);
+                this->merged = true;
+                this->shared.store(mergedFlag | value, std::memory_order_relaxed);
+                return;
+            }
+            this->owner->refs.fetch_add(1, std::memory_order_relaxed);
+            this->next = this->owner->biased;
+            if (this->next != nullptr) {
+                this->next->prev = this;
+            }
+            this->owner->biased = this;
+        }
+
+        ~Count() {
+            //only still linked if the block is freed without ever being released, on the owner, e.g. MakeShared's constructor threw
+            if (!this->merged) {
+                unlink();
+            }
+            if (this->owner != nullptr) {
+                this->owner->unref();
+            }
+        }
+
+        void increment() {
+            if (biasedHere()) {
+                this->local.store(this->local.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            this->shared.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //an unmerged count has not been claimed, so its object is still alive even if the shared count reads zero
+        bool incrementIfNonZero() {
+            if (biasedHere()) {
+                this->local.store(this->local.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return true;
+            }
+            std::uint64_t cur = this->shared.load(std::memory_order_relaxed);
+            while (cur != mergedFlag) {
+                if (this->shared.compare_exchange_weak(cur, cur + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+                detail::noteCasRetry();
+            }
+            return false;
+        }
+
+        bool decrement() {
+            if (biasedHere()) {
+                unsigned int remaining = this->local.load(std::memory_order_relaxed) - 1;
+                this->local.store(remaining, std::memory_order_relaxed);
+                if (remaining == 0) {
+                    //the owner drops its bias, the object is dead if no other thread holds a reference
+                    return (merge() & ~mergedFlag) == 0;
+                }
+                if (this->owner->hasPending.load(std::memory_order_relaxed)) {
+                    //may free this object, nothing below touches it
+                    Biased::processPending();
+                }
+                return false;
+            }
+            return releaseShared();
+        }
+
+        //local plus shared, exact on the owner when no release is waiting in its pending list and a best effort otherwise
+        unsigned int load() const {
+            std::uint64_t sharedCount = this->shared.load(std::memory_order_acquire) & ~mergedFlag;
+            return static_cast<unsigned int>(sharedCount) + this->local.load(std::memory_order_relaxed);
+        }
+};
+
+template <typename T, typename Counting>
+class RefCounted;
+
+//a biased count finds its control block from its own address, so it cannot be embedded in an object by RefCounted
+template <typename T>
+class RefCounted<T, Biased>;
+
+inline void Biased::finishRelease(Count* count) {
+    static_assert(std::is_standard_layout<detail::ControlBlock<Biased>>::value, "the count is found from its block by address");
+    reinterpret_cast<detail::ControlBlock<Biased>*>(count)->finishRelease();
+}
+
+inline void Biased::processPending() {
+    Owner* owner = threadState().owner;
+    if (owner == nullptr) {
+        return;
+    }
+    std::vector<Count*> pending;
+    {
+        std::lock_guard<std::mutex> guard(owner->mtx);
+        pending.swap(owner->pending);
+        owner->hasPending.store(false, std::memory_order_relaxed);
+    }
+    for (Count* count : pending) {
+        if (!count->merged) {
+            count->merge();
+        }
+        if (count->releaseShared()) {
+            finishRelease(count);
+        }
+    }
+}
+
+inline void Biased::retireOwner() {
+    ThreadState& state = threadState();
+    Owner* owner = state.owner;
+    state.owner = nullptr;
+    state.exited = true;
+    std::vector<Count*> pending;
+    {
+        //merged under the mutex, so a thread that finds the owner gone also finds the count merged
+        std::lock_guard<std::mutex> guard(owner->mtx);
+        owner->alive = false;
+        while (owner->biased != nullptr) {
+            owner->biased->merge();
+        }
+        pending.swap(owner->pending);
+    }
+    for (Count* count : pending) {
+        if (count->releaseShared()) {
+            finishRelease(count);
+        }
+    }
+    owner->unref();
+}
+
+#endif // BIASED_POLICY_H
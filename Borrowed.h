@@ -0,0 +1,121 @@
+#ifndef BORROWED_H
+#define BORROWED_H
+
+#include "SharedPtr.h"
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+/* A non-owning view of an object owned by a SharedPtr, for passing it down a call chain without count traffic:
+* helpers take Borrowed<T> by value where they would take SharedPtr<T>, and callers pass their SharedPtr as is.
+* Copying a Borrowed copies two pointers and touches no count, it is only valid while some SharedPtr keeps the
+* object alive, which the caller guarantees for the duration of the call. A callee that has to keep the object
+* calls toShared(), which costs the one increment a by-value SharedPtr would have cost on every call.
+*
+* Borrowing from a temporary SharedPtr does not compile, the object could be gone by the time the view is used.
+*
+* With SHAREDPTR_DEBUG_CHECKS (see ThreadingPolicy.h), like SingleThreaded's owner check, a view holds a weak reference
+* to the control block and asserts when it is used or destroyed after the last owner of its object is gone. Otherwise
+* the view is trivially copyable.
+*/
+template <typename T, typename Policy>
+class Borrowed {
+    private:
+        static_assert(!std::is_array<T>::value && !detail::IsIntrusive<Policy>::value,
+                      "Borrowed views a single object in a control block, intrusive objects are borrowed as plain T*");
+
+        typedef detail::ControlBlock<Policy> Block;
+
+        T* ptr;
+        //the owners' block, kept for toShared(), nullptr when borrowed from an empty SharedPtr
+        Block* block;
+
+        template <typename U, typename P>
+        friend class Borrowed;
+
+#if SHAREDPTR_DEBUG_CHECKS
+        void attach() const {
+            if (this->block != nullptr) {
+                this->block->acquireWeak();
+            }
+        }
+        void detach() const {
+            if (this->block != nullptr) {
+                checkOwned();
+                this->block->releaseWeak();
+            }
+        }
+        void checkOwned() const {
+            assert((this->block == nullptr || this->block->count.load() != 0) && "Borrowed used after the last SharedPtr owning its object was released");
+        }
+#else
+        void attach() const {}
+        void detach() const {}
+        void checkOwned() const {}
+#endif
+    public:
+        constexpr Borrowed() noexcept : ptr(nullptr), block(nullptr) {}
+        constexpr Borrowed(std::nullptr_t) noexcept : ptr(nullptr), block(nullptr) {}
+
+        //view the object of owner, which has to outlive the view
+        Borrowed(const SharedPtr<T, Policy> & owner) noexcept : ptr(owner.ptr), block(owner.block) {
+            attach();
+        }
+        Borrowed(const SharedPtr<T, Policy> && owner) = delete;
+
+        //views of derived objects convert to views of their bases, like SharedPtr
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        Borrowed(const SharedPtr<U, Policy> & owner) noexcept : ptr(owner.ptr), block(owner.block) {
+            attach();
+        }
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        Borrowed(const SharedPtr<U, Policy> && owner) = delete;
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        Borrowed(const Borrowed<U, Policy> & obj) noexcept : ptr(obj.ptr), block(obj.block) {
+            attach();
+        }
+
+#if SHAREDPTR_DEBUG_CHECKS
+        Borrowed(const Borrowed & obj) noexcept : ptr(obj.ptr), block(obj.block) {
+            attach();
+        }
+        Borrowed& operator=(const Borrowed & obj) noexcept {
+            obj.attach();
+            detach();
+            this->ptr = obj.ptr;
+            this->block = obj.block;
+            return *this;
+        }
+        ~Borrowed() {
+            detach();
+        }
+#endif
+
+        //a new owner of the object, one increment
+        SharedPtr<T, Policy> toShared() const {
+            checkOwned();
+            if (this->block == nullptr) {
+                return SharedPtr<T, Policy>();
+            }
+            //the caller's owner keeps the count above zero, a plain increment is enough
+            this->block->acquire();
+            detail::collectCasRetries<T>();
+            detail::recordEvent<T>(detail::statsCopied);
+            return SharedPtr<T, Policy>(this->ptr, this->block);
+        }
+
+        T* operator->() const {
+            checkOwned();
+            return this->ptr;
+        }
+        T& operator*() const {
+            checkOwned();
+            return *this->ptr;
+        }
+        T* get() const {
+            checkOwned();
+            return this->ptr;
+        }
+};
+
+#endif // BORROWED_H
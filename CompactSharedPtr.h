@@ -0,0 +1,155 @@
+#ifndef COMPACT_SHARED_PTR_H
+#define COMPACT_SHARED_PTR_H
+
+#include "SharedPtr.h"
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/* An owning handle one pointer wide, for containers holding millions of handles where SharedPtr's two pointers per
+* element halve the handles that fit in a cache line. It only stores the address of a MakeShared block; the object
+* lives at a fixed offset inside that block, so get() is an addition and never a load.
+*
+* Only objects created by MakeShared (or MakeCompactShared) can be held, since every other block keeps the object
+* somewhere only the block knows. A SharedPtr can be made compact when it points to the object of such a block,
+* which is recognized by the block's hooks table, so the check costs no space. Converting either way takes one
+* increment when copying and none when moving. Weak observers go through the SharedPtr side.
+*/
+template <typename T, typename Policy>
+class CompactSharedPtr {
+    private:
+        static_assert(!std::is_array<T>::value && !detail::IsIntrusive<Policy>::value,
+                      "CompactSharedPtr holds single objects in control blocks, SharedPtr<T, Intrusive<>> is already one pointer");
+
+        typedef detail::InplaceBlock<T, Policy> Block;
+
+        //MakeShared block the object lives in, nullptr when empty
+        Block* block;
+
+        //the block of obj if it is a MakeShared block and obj points to its object, otherwise nullptr
+        static Block* inplaceBlockOf(const SharedPtr<T, Policy> & obj) {
+            if (obj.block == nullptr || !obj.block->template is<Block>()) {
+                return nullptr;
+            }
+            Block* block = static_cast<Block*>(obj.block);
+            return block->object() == obj.ptr ? block : nullptr;
+        }
+
+        static Block* requireInplaceBlock(const SharedPtr<T, Policy> & obj) {
+            Block* block = inplaceBlockOf(obj);
+            if (block == nullptr && obj.block != nullptr) {
+                throw std::invalid_argument("CompactSharedPtr can only hold objects created by MakeShared");
+            }
+            return block;
+        }
+    public:
+        constexpr CompactSharedPtr() noexcept : block(nullptr) {}
+        constexpr CompactSharedPtr(std::nullptr_t) noexcept : block(nullptr) {}
+
+        //share obj's object, throws std::invalid_argument unless canHold(obj)
+        explicit CompactSharedPtr(const SharedPtr<T, Policy> & obj) : block(requireInplaceBlock(obj)) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        //take over obj's reference without touching the count, same requirement, obj is left as it was if it throws
+        explicit CompactSharedPtr(SharedPtr<T, Policy> && obj) : block(requireInplaceBlock(obj)) {
+            obj.ptr = nullptr;
+            obj.block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+
+        //true if obj is empty or points to the object of a MakeShared block
+        static bool canHold(const SharedPtr<T, Policy> & obj) {
+            return obj.block == nullptr || inplaceBlockOf(obj) != nullptr;
+        }
+
+        CompactSharedPtr(const CompactSharedPtr & obj) : block(obj.block) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        //copy and swap, the old object may own obj (head = head->next)
+        CompactSharedPtr& operator=(const CompactSharedPtr & obj) {
+            CompactSharedPtr(obj).swap(*this);
+            return *this;
+        }
+
+        CompactSharedPtr(CompactSharedPtr && obj) noexcept : block(obj.block) {
+            obj.block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+        CompactSharedPtr& operator=(CompactSharedPtr && obj) noexcept {
+            CompactSharedPtr(std::move(obj)).swap(*this);
+            return *this;
+        }
+
+        void swap(CompactSharedPtr & obj) noexcept {
+            std::swap(this->block, obj.block);
+        }
+
+        ~CompactSharedPtr() {
+            cleanup();
+        }
+
+        //back to a regular SharedPtr, one increment for a copy and none from an rvalue
+        SharedPtr<T, Policy> toShared() const & {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+            return this->block ? SharedPtr<T, Policy>(this->block->object(), this->block) : SharedPtr<T, Policy>();
+        }
+        SharedPtr<T, Policy> toShared() && {
+            Block* block = this->block;
+            this->block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+            return block ? SharedPtr<T, Policy>(block->object(), block) : SharedPtr<T, Policy>();
+        }
+
+        T* operator->() const {
+            return get();
+        }
+        T& operator*() const {
+            return *get();
+        }
+
+        unsigned int getCount() const {
+            return this->block ? this->block->count.load() : 0;
+        }
+        T* get() const {
+            return this->block ? this->block->object() : nullptr;
+        }
+
+        void reset() noexcept {
+            cleanup();
+            this->block = nullptr;
+            detail::recordEvent<T>(detail::statsReset);
+        }
+
+    private:
+        void acquire() const {
+            if (this->block != nullptr) {
+                this->block->acquire();
+                detail::collectCasRetries<T>();
+            }
+        }
+
+        void cleanup() {
+            if (this->block != nullptr) {
+                detail::recordEvent<T>(detail::statsReleased);
+                if constexpr (detail::BatchesReleases<T, Policy>::value) {
+                    if (detail::ReleaseBuffer<Policy>::defer(this->block)) {
+                        return;
+                    }
+                }
+                this->block->release();
+                detail::collectCasRetries<T>();
+            }
+        }
+};
+
+//MakeShared straight into a compact handle
+template <typename T, typename Policy = MultiThreaded, typename... Args>
+CompactSharedPtr<T, Policy> MakeCompactShared(Args&&... args) {
+    return CompactSharedPtr<T, Policy>(MakeShared<T, Policy>(std::forward<Args>(args)...));
+}
+
+#endif // COMPACT_SHARED_PTR_H
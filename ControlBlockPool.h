@@ -0,0 +1,274 @@
+#ifndef CONTROL_BLOCK_POOL_H
+#define CONTROL_BLOCK_POOL_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/* Control blocks come from the global allocator unless pooling is switched on, either for every type by defining
+* SHAREDPTR_POOLED_CONTROL_BLOCKS to 1 before including SharedPtr.h, or per type by specializing
+* PooledControlBlocks<T> to std::true_type.
+*/
+#ifndef SHAREDPTR_POOLED_CONTROL_BLOCKS
+#define SHAREDPTR_POOLED_CONTROL_BLOCKS 0
+#endif
+
+template <typename T>
+struct PooledControlBlocks : std::integral_constant<bool, SHAREDPTR_POOLED_CONTROL_BLOCKS != 0> {};
+
+namespace detail {
+    /* Fixed size block allocator shared by every control block type that rounds up to the same Size, so the
+    * pointer-adopting blocks of all types (which all have the same layout) draw from one pool.
+    *
+    * Each thread allocates from and frees into its own free list without any synchronization. Blocks freed on a
+    * different thread than the one that allocated them simply join the freeing thread's list. When a list grows past
+    * two batches, one batch is handed to a shared depot under a mutex, and an empty list refills with one batch from
+    * the depot, or by carving a fresh slab, so the mutex is taken at most once per batchSize allocations. Slabs are
+    * kept for the life of the process and reused, the pool never returns memory to the global allocator.
+    */
+    template <std::size_t Size>
+    class BlockPool {
+        private:
+            static_assert(Size % alignof(std::max_align_t) == 0, "pool sizes are rounded to the fundamental alignment");
+
+            struct FreeBlock {
+                FreeBlock* next;
+            };
+
+            static constexpr std::size_t batchSize = 64;
+            static constexpr std::size_t slabBlocks = 256;
+
+            //lists of free blocks, batchSize long except for the leftovers of exited threads, plus every slab ever carved
+            struct Depot {
+                std::mutex mtx;
+                std::vector<FreeBlock*> batches;
+                std::vector<void*> slabs;
+            };
+
+            //trivially destructible so it stays usable while other thread_local destructors free blocks at thread exit
+            struct ThreadCache {
+                FreeBlock* head;
+                std::size_t count;
+                bool retired;
+            };
+
+            //hands the thread's blocks back to the depot when the thread exits, other threads may still be using them
+            struct CacheRetirer {
+                ~CacheRetirer() {
+                    ThreadCache& cache = BlockPool::threadCache();
+                    while (cache.count >= batchSize) {
+                        BlockPool::flushBatch(cache);
+                    }
+                    Depot& depot = BlockPool::depot();
+                    std::lock_guard<std::mutex> guard(depot.mtx);
+                    if (cache.head != nullptr) {
+                        //a short list still goes back as a batch, refill() copes with batches of any length
+                        depot.batches.push_back(cache.head);
+                    }
+                    cache.head = nullptr;
+                    cache.count = 0;
+                    cache.retired = true;
+                }
+            };
+
+            //never destroyed, so blocks freed during static destruction still have somewhere to go
+            static Depot& depot() {
+                static Depot* instance = new Depot();
+                return *instance;
+            }
+
+            static ThreadCache& threadCache() {
+                thread_local ThreadCache cache = {nullptr, 0, false};
+                return cache;
+            }
+
+            //called whenever the cache goes from empty to non-empty, so every thread holding blocks flushes them on exit
+            static void registerRetirer() {
+                thread_local CacheRetirer retirer;
+                (void)retirer;
+            }
+
+            static void refill(ThreadCache& cache) {
+                registerRetirer();
+                Depot& depot = BlockPool::depot();
+                {
+                    std::lock_guard<std::mutex> guard(depot.mtx);
+                    if (!depot.batches.empty()) {
+                        cache.head = depot.batches.back();
+                        depot.batches.pop_back();
+                        for (FreeBlock* block = cache.head; block != nullptr; block = block->next) {
+                            ++cache.count;
+                        }
+                        return;
+                    }
+                }
+                unsigned char* slab = static_cast<unsigned char*>(::operator new(Size * slabBlocks));
+                {
+                    std::lock_guard<std::mutex> guard(depot.mtx);
+                    depot.slabs.push_back(slab);
+                }
+                for (std::size_t i = slabBlocks; i > 0; --i) {
+                    FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + (i - 1) * Size);
+                    block->next = cache.head;
+                    cache.head = block;
+                }
+                cache.count = slabBlocks;
+            }
+
+            static void flushBatch(ThreadCache& cache) {
+                FreeBlock* batch = cache.head;
+                FreeBlock* last = batch;
+                for (std::size_t i = 1; i < batchSize; ++i) {
+                    last = last->next;
+                }
+                cache.head = last->next;
+                cache.count -= batchSize;
+                last->next = nullptr;
+                Depot& depot = BlockPool::depot();
+                std::lock_guard<std::mutex> guard(depot.mtx);
+                depot.batches.push_back(batch);
+            }
+
+            //slow path for threads whose cache was already retired, every block goes through the depot directly
+            static void* allocateRetired() {
+                Depot& depot = BlockPool::depot();
+                {
+                    std::lock_guard<std::mutex> guard(depot.mtx);
+                    if (!depot.batches.empty()) {
+                        FreeBlock* block = depot.batches.back();
+                        depot.batches.pop_back();
+                        if (block->next != nullptr) {
+                            depot.batches.push_back(block->next);
+                        }
+                        return block;
+                    }
+                }
+                return ::operator new(Size);
+            }
+
+            static void deallocateRetired(FreeBlock* block) {
+                Depot& depot = BlockPool::depot();
+                std::lock_guard<std::mutex> guard(depot.mtx);
+                block->next = nullptr;
+                depot.batches.push_back(block);
+            }
+
+        public:
+            static void* allocate() {
+                ThreadCache& cache = threadCache();
+                if (cache.head == nullptr) {
+                    if (cache.retired) {
+                        return allocateRetired();
+                    }
+                    refill(cache);
+                }
+                FreeBlock* block = cache.head;
+                cache.head = block->next;
+                --cache.count;
+                return block;
+            }
+
+            static void deallocate(void* ptr) {
+                ThreadCache& cache = threadCache();
+                FreeBlock* block = static_cast<FreeBlock*>(ptr);
+                if (cache.head == nullptr) {
+                    if (cache.retired) {
+                        deallocateRetired(block);
+                        return;
+                    }
+                    registerRetirer();
+                }
+                block->next = cache.head;
+                cache.head = block;
+                if (++cache.count >= 2 * batchSize) {
+                    flushBatch(cache);
+                }
+            }
+    };
+
+    constexpr std::size_t poolSizeClass(std::size_t size) {
+        return (size + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+    }
+
+    /* Largest block the pool serves. MakeShared blocks embed the object, and a slab of large objects would pin
+    * slabBlocks times their size for the rest of the process, so those go to the global allocator.
+    */
+    constexpr std::size_t maxPooledBlockSize = 128;
+
+    //whether a block of V for objects of type T comes from the pool
+    template <typename T, typename V>
+    struct PoolsBlock : std::integral_constant<bool, PooledControlBlocks<T>::value && sizeof(V) <= maxPooledBlockSize
+        && alignof(V) <= alignof(std::max_align_t)> {};
+
+    /* Mixed into the concrete control blocks to route their new and delete through the pool when pooling is enabled for
+    * T and the block is small. Over-aligned blocks always use the global aligned allocator, the pool only hands out
+    * fundamentally aligned memory.
+    */
+    template <typename T, typename Block>
+    struct PoolAllocated {
+        static void* operator new(std::size_t size) {
+            if constexpr (PoolsBlock<T, Block>::value) {
+                return BlockPool<poolSizeClass(sizeof(Block))>::allocate();
+            }
+            return ::operator new(size);
+        }
+        static void operator delete(void* ptr) {
+            if constexpr (PoolsBlock<T, Block>::value) {
+                BlockPool<poolSizeClass(sizeof(Block))>::deallocate(ptr);
+            } else {
+                ::operator delete(ptr);
+            }
+        }
+        static void* operator new(std::size_t size, std::align_val_t alignment) {
+            return ::operator new(size, alignment);
+        }
+        static void operator delete(void* ptr, std::align_val_t alignment) {
+            ::operator delete(ptr, alignment);
+        }
+    };
+
+    /* Standard allocator drawing single small objects from the pool of their size when pooling is enabled for T, for
+    * control blocks whose layout is not ours to decide, such as those of the std::shared_ptrs SharedPtr::toStd() makes.
+    * Everything else goes to std::allocator.
+    */
+    template <typename V, typename T>
+    struct PoolAllocator {
+        typedef V value_type;
+
+        PoolAllocator() noexcept {}
+        template <typename U>
+        PoolAllocator(const PoolAllocator<U, T>&) noexcept {}
+
+        V* allocate(std::size_t n) {
+            if constexpr (PoolsBlock<T, V>::value) {
+                if (n == 1) {
+                    return static_cast<V*>(BlockPool<poolSizeClass(sizeof(V))>::allocate());
+                }
+            }
+            return std::allocator<V>().allocate(n);
+        }
+        void deallocate(V* ptr, std::size_t n) {
+            if constexpr (PoolsBlock<T, V>::value) {
+                if (n == 1) {
+                    BlockPool<poolSizeClass(sizeof(V))>::deallocate(ptr);
+                    return;
+                }
+            }
+            std::allocator<V>().deallocate(ptr, n);
+        }
+
+        template <typename U>
+        bool operator==(const PoolAllocator<U, T>&) const noexcept {
+            return true;
+        }
+        template <typename U>
+        bool operator!=(const PoolAllocator<U, T>&) const noexcept {
+            return false;
+        }
+    };
+}
+
+#endif // CONTROL_BLOCK_POOL_H
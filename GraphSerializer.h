@@ -0,0 +1,482 @@
+#ifndef GRAPH_SERIALIZER_H
+#define GRAPH_SERIALIZER_H
+
+#include "SharedPtr.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* Saving and loading graphs of SharedPtr<T> nodes that share children, for warm restarts of large in-memory graphs.
+* Nodes are told apart by their control block, so a node reachable from many parents (or many roots) is written once
+* and loaded once, and every parent gets a handle to that one object: after loading, each count is the number of
+* parents and roots pointing at the node, exactly as before saving.
+*
+* How a node's fields are stored is up to a GraphCodec<T> specialization:
+*
+*     template <>
+*     struct GraphCodec<Node> {
+*         //call visit(child) for every SharedPtr<Node> the node holds, a temporary such as compact.toShared() is fine
+*         template <typename Visit>
+*         static void forEachChild(const Node& node, Visit&& visit);
+*         //write the node's fields with writeValue(), writeString(), ... and its children with writeChild()
+*         static void save(const Node& node, GraphWriter<Node>& out);
+*         //read the fields back in the same order and build the node, typically with MakeShared
+*         static SharedPtr<Node> load(GraphReader<Node>& in);
+*     };
+*
+* The writer walks the graph depth first with its own stack, so deep graphs do not overflow the thread's, and writes
+* every node after its children. The reader therefore only ever meets children it has built already, and builds
+* each node in one go from its fields and finished children. Cycles of SharedPtrs cannot be saved (they would leak
+* anyway), the writer throws std::invalid_argument when it finds one. A block must hold a single node: aliasing
+* handles to different objects in one block would come back as one node.
+*
+* The format is a short header followed by node and root records, with children as varint ids. Values are stored
+* with their in-memory bytes, so a file is only meant to be read back by the same build on the same platform.
+*/
+template <typename T>
+struct GraphCodec;
+
+namespace detail {
+    //"SPGRAPH" and a format version
+    constexpr char graphMagic[8] = {'S', 'P', 'G', 'R', 'A', 'P', 'H', 1};
+
+    /* Node ids by control block address for GraphWriter, open addressing with linear probing in one flat array.
+    * Saving looks up every edge, and a std::unordered_map's allocation per node and pointer chase per lookup cost
+    * more than writing the nodes does. Blocks are never removed, and the table doubles at half full.
+    */
+    class BlockIds {
+        private:
+            struct Slot {
+                //nullptr while free
+                const void* block;
+                std::uint64_t id;
+            };
+
+            std::vector<Slot> slots;
+            std::size_t used;
+
+            std::size_t home(const void* block) const {
+                //the low bits of a block address are always the same, the top bits of the product depend on all of them
+                std::uint64_t mixed = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(block)) * 0x9E3779B97F4A7C15ull;
+                return static_cast<std::size_t>(mixed >> 32) & (this->slots.size() - 1);
+            }
+
+            Slot& probe(const void* block) {
+                std::size_t mask = this->slots.size() - 1;
+                std::size_t i = home(block);
+                while (this->slots[i].block != nullptr && this->slots[i].block != block) {
+                    i = (i + 1) & mask;
+                }
+                return this->slots[i];
+            }
+
+            void grow() {
+                std::vector<Slot> old(this->slots.size() * 2, Slot{nullptr, 0});
+                old.swap(this->slots);
+                for (const Slot& slot : old) {
+                    if (slot.block != nullptr) {
+                        probe(slot.block) = slot;
+                    }
+                }
+            }
+
+        public:
+            BlockIds() : slots(1024, Slot{nullptr, 0}), used(0) {}
+
+            //the id of block, nullptr if it has none
+            std::uint64_t* find(const void* block) {
+                Slot& slot = probe(block);
+                return slot.block != nullptr ? &slot.id : nullptr;
+            }
+
+            //give block the id if it has none yet, returns false and leaves its id alone if it has one
+            bool insert(const void* block, std::uint64_t id) {
+                if (2 * (this->used + 1) > this->slots.size()) {
+                    grow();
+                }
+                Slot& slot = probe(block);
+                if (slot.block != nullptr) {
+                    return false;
+                }
+                slot = Slot{block, id};
+                ++this->used;
+                return true;
+            }
+    };
+
+    enum GraphRecord : std::uint64_t {
+        graphEnd = 0,
+        //a node's fields, its id is the number of nodes before it
+        graphNode = 1,
+        //a reference to a node the caller gets back from the reader
+        graphRoot = 2
+    };
+}
+
+/* Streams a graph to an std::ostream. Roots are written one at a time and the writer remembers every node it wrote,
+* so nodes shared between roots are still written once. finish() has to be called after the last root. If anything
+* throws, what was written so far is not a valid graph and the writer must not be used anymore.
+*/
+template <typename T, typename Policy = MultiThreaded>
+class GraphWriter {
+    private:
+        static_assert(!std::is_array<T>::value && !detail::IsIntrusive<Policy>::value,
+                      "GraphWriter identifies nodes by their control block, arrays and intrusive objects are not supported");
+
+        typedef detail::ControlBlock<Policy> Block;
+        //what the id of a node whose children are still being written is set to
+        static constexpr std::uint64_t visiting = ~std::uint64_t(0);
+        //bytes collected before they are handed to the stream
+        static constexpr std::size_t flushSize = 64 * 1024;
+
+        //holds its own handle, forEachChild() may pass a temporary that is gone before the node comes up
+        struct Visit {
+            SharedPtr<T, Policy> node;
+            //set once the node's children are pushed, it is written when it comes up again
+            bool expanded;
+        };
+
+        std::ostream& out;
+        std::vector<char> buffer;
+        detail::BlockIds ids;
+        std::uint64_t nextId;
+        std::vector<Visit> pending;
+
+        void flush() {
+            this->out.write(this->buffer.data(), static_cast<std::streamsize>(this->buffer.size()));
+            this->buffer.clear();
+            if (!this->out) {
+                throw std::runtime_error("writing the graph failed");
+            }
+        }
+
+        //write every node reachable from root that is not written yet, children first
+        void writeNodes(const SharedPtr<T, Policy>& root) {
+            this->pending.push_back(Visit{root, false});
+            while (!this->pending.empty()) {
+                Visit visit = std::move(this->pending.back());
+                this->pending.pop_back();
+                if (visit.expanded) {
+                    writeVarint(detail::graphNode);
+                    GraphCodec<T>::save(*visit.node.get(), *this);
+                    *this->ids.find(visit.node.block) = this->nextId++;
+                    continue;
+                }
+                if (!this->ids.insert(visit.node.block, visiting)) {
+                    //a node still visiting is an ancestor of the parent that pushed it
+                    if (*this->ids.find(visit.node.block) == visiting) {
+                        throw std::invalid_argument("GraphWriter cannot save a cycle of SharedPtrs");
+                    }
+                    continue;
+                }
+                const T& node = *visit.node.get();
+                this->pending.push_back(Visit{std::move(visit.node), true});
+                GraphCodec<T>::forEachChild(node, [this](const SharedPtr<T, Policy>& child) {
+                    if (child.block != nullptr) {
+                        this->pending.push_back(Visit{child, false});
+                    }
+                });
+            }
+        }
+
+    public:
+        explicit GraphWriter(std::ostream& out) : out(out), nextId(0) {
+            this->buffer.reserve(flushSize + 64);
+            writeBytes(detail::graphMagic, sizeof(detail::graphMagic));
+        }
+
+        GraphWriter(const GraphWriter&) = delete;
+        GraphWriter& operator=(const GraphWriter&) = delete;
+
+        //write root and whatever it reaches that is not written yet, GraphReader::readRoot() hands it back in the same order
+        void writeRoot(const SharedPtr<T, Policy>& root) {
+            if (root.block != nullptr) {
+                writeNodes(root);
+            }
+            writeVarint(detail::graphRoot);
+            writeChild(root);
+        }
+
+        //end the graph and flush everything to the stream
+        void finish() {
+            writeVarint(detail::graphEnd);
+            flush();
+            this->out.flush();
+        }
+
+        //nodes written so far
+        std::uint64_t nodes() const {
+            return this->nextId;
+        }
+
+        //the following are for GraphCodec<T>::save()
+
+        void writeBytes(const void* data, std::size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            this->buffer.insert(this->buffer.end(), bytes, bytes + size);
+            if (this->buffer.size() >= flushSize) {
+                flush();
+            }
+        }
+
+        //a trivially copyable value, stored as its bytes
+        template <typename V>
+        void writeValue(const V& value) {
+            static_assert(std::is_trivially_copyable<V>::value, "writeValue stores the bytes of the value, write its fields instead");
+            writeBytes(&value, sizeof(V));
+        }
+
+        //an unsigned integer in as few bytes as it needs, 7 bits per byte
+        void writeVarint(std::uint64_t value) {
+            unsigned char bytes[10];
+            std::size_t size = 0;
+            while (value >= 0x80) {
+                bytes[size++] = static_cast<unsigned char>(value | 0x80);
+                value >>= 7;
+            }
+            bytes[size++] = static_cast<unsigned char>(value);
+            writeBytes(bytes, size);
+        }
+
+        void writeString(const std::string& value) {
+            writeVarint(value.size());
+            writeBytes(value.data(), value.size());
+        }
+
+        //a child of the node being saved, forEachChild() must have visited it, empty children are fine
+        void writeChild(const SharedPtr<T, Policy>& child) {
+            if (child.block == nullptr) {
+                writeVarint(0);
+                return;
+            }
+            const std::uint64_t* id = this->ids.find(child.block);
+            if (id == nullptr || *id == visiting) {
+                throw std::logic_error("GraphCodec::save wrote a child that forEachChild did not visit");
+            }
+            writeVarint(*id + 1);
+        }
+};
+
+/* Reads a graph GraphWriter wrote from memory, such as a MappedFile. The reader holds a handle to every node it has
+* built so later nodes can refer to them, so counts are only back to what they were when saved once the reader is
+* gone. Malformed input makes it throw std::runtime_error.
+*/
+template <typename T, typename Policy = MultiThreaded>
+class GraphReader {
+    private:
+        const unsigned char* pos;
+        const unsigned char* end;
+        //every node built so far, by id
+        std::vector<SharedPtr<T, Policy>> built;
+        bool finished;
+
+        void need(std::size_t size) const {
+            if (static_cast<std::size_t>(this->end - this->pos) < size) {
+                throw std::runtime_error("truncated graph");
+            }
+        }
+
+    public:
+        //data has to stay readable while the reader is used, the nodes copy what they keep out of it
+        GraphReader(const void* data, std::size_t size)
+            : pos(static_cast<const unsigned char*>(data)), end(static_cast<const unsigned char*>(data) + size), finished(false) {
+            need(sizeof(detail::graphMagic));
+            if (std::memcmp(this->pos, detail::graphMagic, sizeof(detail::graphMagic)) != 0) {
+                throw std::runtime_error("not a graph written by GraphWriter");
+            }
+            this->pos += sizeof(detail::graphMagic);
+        }
+
+        GraphReader(const GraphReader&) = delete;
+        GraphReader& operator=(const GraphReader&) = delete;
+
+        //build the nodes up to the next root and move it into root, false (with root untouched) after the last one
+        bool readRoot(SharedPtr<T, Policy>& root) {
+            while (!this->finished) {
+                std::uint64_t record = readVarint();
+                if (record == detail::graphNode) {
+                    this->built.push_back(GraphCodec<T>::load(*this));
+                } else if (record == detail::graphRoot) {
+                    root = readChild();
+                    return true;
+                } else if (record == detail::graphEnd) {
+                    this->finished = true;
+                } else {
+                    throw std::runtime_error("corrupt graph: unknown record");
+                }
+            }
+            return false;
+        }
+
+        //nodes built so far
+        std::size_t nodes() const {
+            return this->built.size();
+        }
+
+        //the following are for GraphCodec<T>::load()
+
+        void readBytes(void* data, std::size_t size) {
+            need(size);
+            std::memcpy(data, this->pos, size);
+            this->pos += size;
+        }
+
+        template <typename V>
+        V readValue() {
+            static_assert(std::is_trivially_copyable<V>::value, "readValue reads the bytes of the value, read its fields instead");
+            V value;
+            readBytes(&value, sizeof(V));
+            return value;
+        }
+
+        std::uint64_t readVarint() {
+            std::uint64_t value = 0;
+            for (unsigned int shift = 0; shift < 64; shift += 7) {
+                need(1);
+                unsigned char byte = *this->pos++;
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) {
+                    return value;
+                }
+            }
+            throw std::runtime_error("corrupt graph: varint too long");
+        }
+
+        std::string readString() {
+            std::uint64_t size = readVarint();
+            need(size);
+            std::string value(reinterpret_cast<const char*>(this->pos), size);
+            this->pos += size;
+            return value;
+        }
+
+        //a child written with writeChild(), it was built before the node being loaded
+        SharedPtr<T, Policy> readChild() {
+            std::uint64_t id = readVarint();
+            if (id == 0) {
+                return SharedPtr<T, Policy>();
+            }
+            if (id > this->built.size()) {
+                throw std::runtime_error("corrupt graph: reference to a node not read yet");
+            }
+            return this->built[id - 1];
+        }
+};
+
+/* A whole file mapped read-only into memory, for loading graphs without copying the file through a buffer first.
+* The pages are read in by the kernel as the reader gets to them. Falls back to reading the file on Windows.
+*/
+class MappedFile {
+    private:
+        const char* bytes;
+        std::size_t length;
+#ifdef _WIN32
+        std::vector<char> contents;
+#endif
+
+    public:
+        explicit MappedFile(const std::string& path) : bytes(nullptr), length(0) {
+#ifdef _WIN32
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+            }
+            this->contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            this->bytes = this->contents.data();
+            this->length = this->contents.size();
+#else
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+            }
+            struct stat info;
+            if (::fstat(fd, &info) != 0) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+            }
+            this->length = static_cast<std::size_t>(info.st_size);
+            //mapping nothing fails, an empty file is just empty
+            if (this->length > 0) {
+                void* mapped = ::mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped == MAP_FAILED) {
+                    int error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::generic_category(), "cannot map " + path);
+                }
+                //graphs are read front to back once
+                ::madvise(mapped, this->length, MADV_SEQUENTIAL);
+                this->bytes = static_cast<const char*>(mapped);
+            }
+            ::close(fd);
+#endif
+        }
+
+        ~MappedFile() {
+#ifndef _WIN32
+            if (this->bytes != nullptr) {
+                ::munmap(const_cast<char*>(this->bytes), this->length);
+            }
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* data() const {
+            return this->bytes;
+        }
+
+        std::size_t size() const {
+            return this->length;
+        }
+};
+
+//write roots and everything they reach to out
+template <typename T, typename Policy>
+void saveGraph(std::ostream& out, const std::vector<SharedPtr<T, Policy>>& roots) {
+    GraphWriter<T, Policy> writer(out);
+    for (const SharedPtr<T, Policy>& root : roots) {
+        writer.writeRoot(root);
+    }
+    writer.finish();
+}
+
+//the roots saveGraph() wrote, read from memory
+template <typename T, typename Policy = MultiThreaded>
+std::vector<SharedPtr<T, Policy>> loadGraph(const void* data, std::size_t size) {
+    GraphReader<T, Policy> reader(data, size);
+    std::vector<SharedPtr<T, Policy>> roots;
+    SharedPtr<T, Policy> root;
+    while (reader.readRoot(root)) {
+        roots.push_back(std::move(root));
+    }
+    return roots;
+}
+
+//the roots saveGraph() wrote, read from a memory mapped file
+template <typename T, typename Policy = MultiThreaded>
+std::vector<SharedPtr<T, Policy>> loadGraphFile(const std::string& path) {
+    MappedFile file(path);
+    return loadGraph<T, Policy>(file.data(), file.size());
+}
+
+#endif // GRAPH_SERIALIZER_H
@@ -0,0 +1,129 @@
+#ifndef MPMC_RING_H
+#define MPMC_RING_H
+
+#include "RefCountStats.h"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+
+namespace detail {
+    /* Vyukov's bounded MPMC ring buffer of trivially copyable values: every slot carries a sequence number saying
+    * which position it is ready for, producers and consumers claim positions with one CAS on their own counter, and
+    * a slot is only touched by the thread that claimed it until that thread publishes it with a release store of the
+    * next sequence number. Slots are cache-line sized and the two counters sit on cache lines of their own, so a
+    * producer and a consumer working on neighbouring values do not share a line. A push or pop of several values
+    * claims a whole run of ready slots with a single CAS.
+    */
+    template <typename Value>
+    class MpmcRing {
+        private:
+            struct alignas(64) Slot {
+                //position the slot is ready for: pos while free for the push of pos, pos + 1 once it holds that push's value
+                std::atomic<std::size_t> sequence;
+                Value value;
+            };
+
+            std::unique_ptr<Slot[]> slots;
+            std::size_t mask;
+            alignas(64) std::atomic<std::size_t> pushPos;
+            alignas(64) std::atomic<std::size_t> popPos;
+
+            Slot& slotAt(std::size_t pos) const {
+                return this->slots[pos & this->mask];
+            }
+
+            //number of consecutive slots from pos, at most max, whose sequence is pos + offset + i, i.e. ready for the claim
+            std::size_t readyRun(std::size_t pos, std::size_t offset, std::size_t max) const {
+                std::size_t ready = 0;
+                while (ready < max && slotAt(pos + ready).sequence.load(std::memory_order_acquire) == pos + ready + offset) {
+                    ++ready;
+                }
+                return ready;
+            }
+
+            /* Claim up to max positions from counter whose slots are ready for it, returning the first one and setting
+            * claimed, which is 0 when the ring is full (for pushes) or empty (for pops). offset is 0 for pushes and 1 for pops.
+            */
+            std::size_t claim(std::atomic<std::size_t>& counter, std::size_t offset, std::size_t max, std::size_t& claimed) {
+                std::size_t pos = counter.load(std::memory_order_relaxed);
+                claimed = 0;
+                if (max == 0) {
+                    return pos;
+                }
+                while (true) {
+                    std::size_t ready = readyRun(pos, offset, max);
+                    if (ready == 0) {
+                        std::size_t sequence = slotAt(pos).sequence.load(std::memory_order_acquire);
+                        //behind: the slot still holds an older lap (full or empty), ahead: another thread claimed pos already
+                        if (static_cast<std::ptrdiff_t>(sequence - (pos + offset)) < 0) {
+                            return pos;
+                        }
+                        pos = counter.load(std::memory_order_relaxed);
+                        continue;
+                    }
+                    //the slots of a run only move on once their claimant publishes them, so they are still ready if pos is unclaimed
+                    if (counter.compare_exchange_weak(pos, pos + ready, std::memory_order_relaxed, std::memory_order_relaxed)) {
+                        claimed = ready;
+                        return pos;
+                    }
+                    noteCasRetry();
+                }
+            }
+
+        public:
+            //a ring holding up to capacity values, which has to be a power of two
+            explicit MpmcRing(std::size_t capacity) : slots(nullptr), mask(capacity - 1), pushPos(0), popPos(0) {
+                if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+                    throw std::invalid_argument("ring capacity must be a power of two");
+                }
+                this->slots.reset(new Slot[capacity]);
+                for (std::size_t i = 0; i < capacity; ++i) {
+                    this->slots[i].sequence.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            MpmcRing(const MpmcRing&) = delete;
+            MpmcRing& operator=(const MpmcRing&) = delete;
+
+            //claim up to max free slots and fill the i-th with write(i, value), returns how many were filled
+            template <typename Write>
+            std::size_t push(std::size_t max, Write&& write) {
+                std::size_t claimed = 0;
+                std::size_t pos = claim(this->pushPos, 0, max, claimed);
+                for (std::size_t i = 0; i < claimed; ++i) {
+                    Slot& slot = slotAt(pos + i);
+                    write(i, slot.value);
+                    slot.sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                return claimed;
+            }
+
+            //claim up to max filled slots, oldest first, and hand the i-th to read(i, value), returns how many were read
+            template <typename Read>
+            std::size_t pop(std::size_t max, Read&& read) {
+                std::size_t claimed = 0;
+                std::size_t pos = claim(this->popPos, 1, max, claimed);
+                for (std::size_t i = 0; i < claimed; ++i) {
+                    Slot& slot = slotAt(pos + i);
+                    read(i, slot.value);
+                    //the slot is free again for the push one lap later
+                    slot.sequence.store(pos + i + this->mask + 1, std::memory_order_release);
+                }
+                return claimed;
+            }
+
+            std::size_t capacity() const {
+                return this->mask + 1;
+            }
+
+            //values held right now, only a snapshot while other threads push and pop
+            std::size_t approximateSize() const {
+                std::size_t popped = this->popPos.load(std::memory_order_relaxed);
+                std::size_t pushed = this->pushPos.load(std::memory_order_relaxed);
+                return pushed > popped ? pushed - popped : 0;
+            }
+    };
+}
+
+#endif // MPMC_RING_H
@@ -0,0 +1,203 @@
+#ifndef RECLAIMER_H
+#define RECLAIMER_H
+
+#include "ThreadingPolicy.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/* Objects are destroyed inline by whichever thread drops the last owner, unless deferred destruction is switched on,
+* either for every type by defining SHAREDPTR_DEFERRED_DESTRUCTION to 1 before including SharedPtr.h, or per type by
+* specializing DeferredDestruction<T> to std::true_type. Deferred objects are handed to the Reclaimer instead, so a
+* request thread releasing a large object graph does not pay for freeing it.
+*/
+#ifndef SHAREDPTR_DEFERRED_DESTRUCTION
+#define SHAREDPTR_DEFERRED_DESTRUCTION 0
+#endif
+
+template <typename T>
+struct DeferredDestruction : std::integral_constant<bool, SHAREDPTR_DEFERRED_DESTRUCTION != 0> {};
+
+/* Bounded queue of objects whose last owner is gone but which have not been destroyed yet. It is drained either by a
+* dedicated thread, started with startThread(), or by the application calling flush() at points of its choosing, for
+* example once per batch of requests. flush() returns only after everything queued before the call (and anything
+* their destructors queue in turn) has been destroyed, so it also serves shutdown and tests.
+*
+* Backpressure: once capacity objects are waiting, further releases destroy their object inline again, so memory
+* held by dead objects stays bounded even when nothing drains the queue.
+*
+* Destructors run without any of the reclaimer's locks held, so they may release further deferred objects or call
+* flush() themselves. A flush() from inside a destructor the reclaimer runs destroys what is queued but does not wait
+* for other drains, the rest of its own batch included.
+*
+* The instance is never destroyed, so releases during static destruction still work; stop the thread or flush before
+* exiting if queued destructors have to run.
+*/
+class Reclaimer {
+    public:
+        struct Stats {
+            //objects handed to the queue
+            std::uint64_t queued;
+            //queued objects destroyed by flush() or the reclaimer thread
+            std::uint64_t reclaimed;
+            //objects destroyed inline because the queue was full
+            std::uint64_t destroyedInline;
+        };
+
+    private:
+        struct Entry {
+            void* object;
+            void (*reclaim)(void*);
+        };
+
+        mutable std::mutex mtx;
+        std::condition_variable wake;
+        std::vector<Entry> queue;
+        std::size_t capacity;
+        std::thread worker;
+        bool stopping;
+        //batches taken off the queue and still being destroyed, so flush() cannot return before older objects are gone
+        std::size_t draining;
+        std::condition_variable drained;
+        std::atomic<std::uint64_t> queuedTotal;
+        std::atomic<std::uint64_t> reclaimedTotal;
+        std::atomic<std::uint64_t> inlineTotal;
+
+        Reclaimer() : capacity(4096), stopping(false), draining(0), queuedTotal(0), reclaimedTotal(0), inlineTotal(0) {}
+
+        //batches the calling thread is destroying right now, more than one when a destructor flushes
+        static std::size_t& threadDrains() {
+            thread_local std::size_t drains = 0;
+            return drains;
+        }
+
+        //destroy one batch of queued objects with no lock held, false if the queue was empty
+        bool drain() {
+            std::vector<Entry> batch;
+            {
+                std::lock_guard<std::mutex> guard(this->mtx);
+                if (this->queue.empty()) {
+                    return false;
+                }
+                batch.swap(this->queue);
+                ++this->draining;
+            }
+            ++threadDrains();
+            for (const Entry& entry : batch) {
+                entry.reclaim(entry.object);
+            }
+            --threadDrains();
+            this->reclaimedTotal.fetch_add(batch.size(), std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> guard(this->mtx);
+                --this->draining;
+            }
+            this->drained.notify_all();
+            return true;
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(this->mtx);
+            while (true) {
+                this->wake.wait(lock, [this] { return this->stopping || !this->queue.empty(); });
+                if (this->stopping) {
+                    return;
+                }
+                lock.unlock();
+                drain();
+                lock.lock();
+            }
+        }
+
+    public:
+        Reclaimer(const Reclaimer&) = delete;
+        Reclaimer& operator=(const Reclaimer&) = delete;
+
+        static Reclaimer& instance() {
+            static Reclaimer* reclaimer = new Reclaimer();
+            return *reclaimer;
+        }
+
+        //queue reclaim(object) to run later, or run it right away if capacity objects are already waiting
+        void defer(void* object, void (*reclaim)(void*)) {
+            {
+                std::lock_guard<std::mutex> guard(this->mtx);
+                if (this->queue.size() < this->capacity) {
+                    this->queue.push_back(Entry{object, reclaim});
+                    this->queuedTotal.fetch_add(1, std::memory_order_relaxed);
+                    //the reclaimer thread only sleeps on an empty queue
+                    if (this->queue.size() == 1) {
+                        this->wake.notify_one();
+                    }
+                    return;
+                }
+            }
+            this->inlineTotal.fetch_add(1, std::memory_order_relaxed);
+            reclaim(object);
+        }
+
+        //destroy everything queued so far on the calling thread, and wait for batches other threads are destroying
+        void flush() {
+            while (drain()) {
+            }
+            //a destructor waiting for other drains could wait on one that waits for it in turn
+            if (threadDrains() != 0) {
+                return;
+            }
+            std::unique_lock<std::mutex> lock(this->mtx);
+            this->drained.wait(lock, [this] { return this->draining == 0; });
+        }
+
+        //maximum number of objects waiting at once, later releases destroy inline
+        void setCapacity(std::size_t capacity) {
+            std::lock_guard<std::mutex> guard(this->mtx);
+            this->capacity = capacity;
+        }
+
+        //start a thread that destroys queued objects as they arrive, does nothing if one is already running
+        void startThread() {
+            std::lock_guard<std::mutex> guard(this->mtx);
+            if (!this->worker.joinable()) {
+                this->stopping = false;
+                this->worker = std::thread(&Reclaimer::run, this);
+            }
+        }
+
+        //stop the reclaimer thread and destroy whatever it left behind
+        void stopThread() {
+            std::thread stopped;
+            {
+                std::lock_guard<std::mutex> guard(this->mtx);
+                this->stopping = true;
+                stopped.swap(this->worker);
+            }
+            this->wake.notify_all();
+            if (stopped.joinable()) {
+                stopped.join();
+            }
+            flush();
+        }
+
+        std::size_t pending() const {
+            std::lock_guard<std::mutex> guard(this->mtx);
+            return this->queue.size();
+        }
+
+        Stats stats() const {
+            return Stats{this->queuedTotal.load(std::memory_order_relaxed), this->reclaimedTotal.load(std::memory_order_relaxed),
+                         this->inlineTotal.load(std::memory_order_relaxed)};
+        }
+};
+
+namespace detail {
+    //SingleThreaded counts must not be touched by the reclaimer thread, so their objects are always destroyed inline
+    template <typename T, typename Policy>
+    struct DefersDestruction : std::integral_constant<bool, DeferredDestruction<T>::value && !std::is_same<Policy, SingleThreaded>::value> {};
+}
+
+#endif // RECLAIMER_H
@@ -0,0 +1,180 @@
+#ifndef RECYCLING_POOL_H
+#define RECYCLING_POOL_H
+
+#include "MpmcRing.h"
+#include "SharedPtr.h"
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+/* Pool of reusable objects handed out as ordinary SharedPtr<T>s, for objects that are expensive to build and cheap to
+* clean: large buffers, parsers with warmed-up internal vectors, preallocated message frames.
+*
+* acquire() takes an idle object from the pool, or default-constructs a new one when there is none. When the last
+* owner of a pooled object lets go, the Reset hook is called on it (reset(object), which must not throw) and, once no
+* WeakPtr is left either, the object and its control block go back onto the pool together instead of being
+* destroyed, so the next acquire() reuses both without any allocation. The idle objects sit in a lock-free
+* detail::MpmcRing shared by every thread, and its capacity caps how many are kept: an object that comes back to
+* a full pool is destroyed. trim(keep) destroys idle objects until at most keep are left. While a thread giving an
+* object back is preempted halfway through, acquire() cannot get past its slot and builds new objects instead.
+*
+* Handles and WeakPtrs may outlive the pool; objects that come back after it is gone are destroyed. Types deriving
+* from EnableSharedFromThis cannot be pooled, their own weak reference would keep them from ever coming back.
+*/
+namespace detail {
+    //the default reset hook leaves recycled objects exactly as their last owner left them
+    struct NoReset {
+        template <typename T>
+        void operator()(T&) const {}
+    };
+
+    template <typename T, typename Reset, typename Policy>
+    struct RecyclingPoolState;
+
+    //an object and its counts in one allocation like InplaceBlock, kept constructed across recycles
+    template <typename T, typename Reset, typename Policy>
+    struct RecycledBlock : ControlBlock<Policy> {
+        typedef RecyclingPoolState<T, Reset, Policy> State;
+
+        State* pool;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        explicit RecycledBlock(State* pool) : ControlBlock<Policy>(&blockHooks<RecycledBlock, Policy>), pool(pool) {
+            ::new (static_cast<void*>(this->storage)) T();
+        }
+
+        ~RecycledBlock() {
+            object()->~T();
+        }
+
+        T* object() {
+            return reinterpret_cast<T*>(this->storage);
+        }
+
+        //a fresh pair of counts for the next owner of a recycled block, one owner and the owners' weak reference
+        void rearm() {
+            typedef typename Policy::Count Count;
+            typedef typename Policy::WeakCount WeakCount;
+            this->count.~Count();
+            ::new (static_cast<void*>(&this->count)) Count(1);
+            this->weakCount.~WeakCount();
+            ::new (static_cast<void*>(&this->weakCount)) WeakCount(1);
+        }
+
+        //the last owner is gone, the object stays constructed for the next one
+        static void disposeObject(ControlBlock<Policy>* block) {
+            RecycledBlock* self = static_cast<RecycledBlock*>(block);
+            recordEvent<T>(statsFreed);
+            self->pool->reset(*self->object());
+        }
+
+        //the last WeakPtr is gone too, nothing can reach the block anymore
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            RecycledBlock* self = static_cast<RecycledBlock*>(block);
+            self->pool->recycle(self);
+        }
+    };
+
+    /* What the pool and its outstanding objects share. refs is one for the RecyclingPool plus one per object that is
+    * out of the pool, so the state lives until the pool is gone and every object has come back.
+    */
+    template <typename T, typename Reset, typename Policy>
+    struct RecyclingPoolState {
+        typedef RecycledBlock<T, Reset, Policy> Block;
+
+        MpmcRing<Block*> idle;
+        Reset reset;
+        //false once the RecyclingPool is destroyed, objects coming back after that are destroyed
+        std::atomic<bool> open;
+        std::atomic<std::size_t> refs;
+
+        RecyclingPoolState(std::size_t capacity, const Reset& reset) : idle(capacity), reset(reset), open(true), refs(1) {}
+
+        ~RecyclingPoolState() {
+            trim(0);
+        }
+
+        //destroy idle objects until at most keep are left
+        void trim(std::size_t keep) {
+            while (this->idle.approximateSize() > keep) {
+                Block* block = nullptr;
+                if (this->idle.pop(1, [&block](std::size_t, Block* value) { block = value; }) == 0) {
+                    return;
+                }
+                delete block;
+            }
+        }
+
+        void recycle(Block* block) {
+            if (!this->open.load(std::memory_order_acquire) || this->idle.push(1, [block](std::size_t, Block*& slot) { slot = block; }) == 0) {
+                delete block;
+            }
+            unref();
+        }
+
+        void unref() {
+            if (this->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                delete this;
+            }
+        }
+    };
+}
+
+template <typename T, typename Reset = detail::NoReset, typename Policy = MultiThreaded>
+class RecyclingPool {
+    private:
+        static_assert(std::is_default_constructible<T>::value, "RecyclingPool builds new objects with T()");
+        static_assert(!std::is_array<T>::value && !detail::IsIntrusive<Policy>::value,
+                      "RecyclingPool recycles a single object together with its control block");
+        static_assert(!std::is_base_of<EnableSharedFromThis<T, Policy>, T>::value,
+                      "a recycled object is never destroyed, so its EnableSharedFromThis reference would keep its block out of the pool");
+
+        typedef detail::RecyclingPoolState<T, Reset, Policy> State;
+        typedef typename State::Block Block;
+
+        State* state;
+
+    public:
+        //a pool keeping up to capacity idle objects, which has to be a power of two, reset is called on every object coming back
+        explicit RecyclingPool(std::size_t capacity, const Reset& reset = Reset()) : state(new State(capacity, reset)) {}
+
+        RecyclingPool(const RecyclingPool&) = delete;
+        RecyclingPool& operator=(const RecyclingPool&) = delete;
+
+        //destroy the idle objects, the ones still out are destroyed when their last owner and observer let go
+        ~RecyclingPool() {
+            this->state->open.store(false, std::memory_order_release);
+            this->state->trim(0);
+            this->state->unref();
+        }
+
+        //an idle object if there is one, a new T() otherwise
+        SharedPtr<T, Policy> acquire() {
+            Block* block = nullptr;
+            if (this->state->idle.pop(1, [&block](std::size_t, Block* value) { block = value; }) == 1) {
+                block->rearm();
+            } else {
+                block = new Block(this->state);
+            }
+            this->state->refs.fetch_add(1, std::memory_order_relaxed);
+            detail::recordEvent<T>(detail::statsCreated);
+            return SharedPtr<T, Policy>(block->object(), block);
+        }
+
+        //destroy idle objects until at most keep are left, for giving memory back after a burst
+        void trim(std::size_t keep = 0) {
+            this->state->trim(keep);
+        }
+
+        //objects waiting in the pool, only a snapshot while other threads acquire and release
+        std::size_t idle() const {
+            return this->state->idle.approximateSize();
+        }
+
+        std::size_t capacity() const {
+            return this->state->idle.capacity();
+        }
+};
+
+#endif // RECYCLING_POOL_H
@@ -0,0 +1,288 @@
+#ifndef REF_COUNT_STATS_H
+#define REF_COUNT_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#if defined(__GNUG__)
+#include <cstdlib>
+#include <cxxabi.h>
+#endif
+
+/* Per-type statistics on what SharedPtrs do, compiled in by defining SHAREDPTR_ENABLE_STATS to 1 before including
+* SharedPtr.h. When it is off (the default) every hook is an empty inline function and nothing is recorded, so the
+* handles compile to exactly what they would without this header.
+*
+* Copies, moves, resets, releases and CAS retries are the frequent events, they are counted in per-thread counters
+* that only their thread writes (a plain load and store, no RMW) and that RefCountStats::collect() sums up on demand.
+* Creations and frees also maintain a per-type atomic live count, since the peak can only be tracked from one place.
+* A thread's counters are folded into its type's totals when the thread exits and then reused by the next thread,
+* events from thread_local handles destroyed after that go to the totals directly.
+*/
+#ifndef SHAREDPTR_ENABLE_STATS
+#define SHAREDPTR_ENABLE_STATS 0
+#endif
+
+//totals for one managed type, as returned by RefCountStats::collect()
+struct TypeStats {
+    const char* type;
+    //objects created and not destroyed yet, and the most there ever were at once
+    std::int64_t live;
+    std::int64_t peakLive;
+    std::uint64_t created;
+    std::uint64_t copies;
+    std::uint64_t moves;
+    std::uint64_t resets;
+    //owners dropped, and how many of those were the last one and destroyed the object
+    std::uint64_t releases;
+    std::uint64_t frees;
+    //compare-exchange attempts that failed because another thread changed the count first
+    std::uint64_t casRetries;
+};
+
+namespace detail {
+    enum StatsEvent {
+        statsCreated,
+        statsCopied,
+        statsMoved,
+        statsReset,
+        statsReleased,
+        statsFreed,
+        statsCasRetry,
+        statsEventCount
+    };
+
+    //one thread's counts for one type, written only by the thread currently holding it
+    struct ThreadStats {
+        std::atomic<std::uint64_t> events[statsEventCount];
+        std::atomic<bool> inUse;
+        ThreadStats* next;
+
+        ThreadStats() : inUse(true), next(nullptr) {
+            for (std::atomic<std::uint64_t>& event : this->events) {
+                event.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    //everything recorded for one type, never freed so it can be reported at any time
+    struct TypeStatsRecord {
+        const char* name;
+        std::atomic<std::int64_t> live;
+        std::atomic<std::int64_t> peakLive;
+        //counts folded in from exited threads
+        std::atomic<std::uint64_t> retired[statsEventCount];
+        std::atomic<ThreadStats*> threads;
+        TypeStatsRecord* next;
+
+        explicit TypeStatsRecord(const char* name) : name(name), live(0), peakLive(0), threads(nullptr), next(nullptr) {
+            for (std::atomic<std::uint64_t>& event : this->retired) {
+                event.store(0, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    struct StatsRegistry {
+        std::mutex mtx;
+        TypeStatsRecord* types;
+    };
+
+    inline StatsRegistry& statsRegistry() {
+        static StatsRegistry* registry = new StatsRegistry{{}, nullptr};
+        return *registry;
+    }
+
+    template <typename T>
+    TypeStatsRecord& typeStatsRecord() {
+        static TypeStatsRecord* record = [] {
+            TypeStatsRecord* created = new TypeStatsRecord(typeid(T).name());
+            StatsRegistry& registry = statsRegistry();
+            std::lock_guard<std::mutex> guard(registry.mtx);
+            created->next = registry.types;
+            registry.types = created;
+            return created;
+        }();
+        return *record;
+    }
+
+    //a ThreadStats for the calling thread, reusing one left behind by an exited thread when possible
+    inline ThreadStats* leaseThreadStats(TypeStatsRecord& record) {
+        for (ThreadStats* free = record.threads.load(std::memory_order_acquire); free != nullptr; free = free->next) {
+            bool idle = false;
+            if (free->inUse.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+                return free;
+            }
+        }
+        ThreadStats* stats = new ThreadStats();
+        ThreadStats* head = record.threads.load(std::memory_order_relaxed);
+        do {
+            stats->next = head;
+        } while (!record.threads.compare_exchange_weak(head, stats, std::memory_order_release, std::memory_order_relaxed));
+        return stats;
+    }
+
+    //trivially destructible so it stays usable while other thread_local destructors release SharedPtrs at thread exit
+    struct ThreadStatsSlot {
+        ThreadStats* stats;
+        bool retired;
+    };
+
+    template <typename T>
+    ThreadStatsSlot& threadStatsSlot() {
+        thread_local ThreadStatsSlot slot = {nullptr, false};
+        return slot;
+    }
+
+    //folds the thread's counts into the type's totals when the thread exits and hands its ThreadStats to the next one
+    template <typename T>
+    struct ThreadStatsRetirer {
+        ~ThreadStatsRetirer() {
+            ThreadStatsSlot& slot = threadStatsSlot<T>();
+            TypeStatsRecord& record = typeStatsRecord<T>();
+            for (int i = 0; i < statsEventCount; ++i) {
+                record.retired[i].fetch_add(slot.stats->events[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                slot.stats->events[i].store(0, std::memory_order_relaxed);
+            }
+            slot.stats->inUse.store(false, std::memory_order_release);
+            slot.stats = nullptr;
+            slot.retired = true;
+        }
+    };
+
+    //add count to the calling thread's counter for event, or straight to the totals once the thread is exiting
+    template <typename T>
+    void countThreadEvent(StatsEvent event, std::uint64_t count) {
+        ThreadStatsSlot& slot = threadStatsSlot<T>();
+        if (slot.stats == nullptr) {
+            if (slot.retired) {
+                typeStatsRecord<T>().retired[event].fetch_add(count, std::memory_order_relaxed);
+                return;
+            }
+            slot.stats = leaseThreadStats(typeStatsRecord<T>());
+            thread_local ThreadStatsRetirer<T> retirer;
+            (void)retirer;
+        }
+        std::atomic<std::uint64_t>& counter = slot.stats->events[event];
+        counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    //CAS retries happen inside the counts, which do not know T, so they are parked here until the handle collects them
+    inline std::uint64_t& pendingCasRetries() {
+        thread_local std::uint64_t pending = 0;
+        return pending;
+    }
+
+    //called by the counting policies whenever a compare-exchange on a count fails
+    inline void noteCasRetry() {
+#if SHAREDPTR_ENABLE_STATS
+        ++pendingCasRetries();
+#endif
+    }
+
+    template <typename T>
+    inline void recordEvent(StatsEvent event) {
+#if SHAREDPTR_ENABLE_STATS
+        countThreadEvent<T>(event, 1);
+        if (event == statsCreated) {
+            TypeStatsRecord& record = typeStatsRecord<T>();
+            std::int64_t live = record.live.fetch_add(1, std::memory_order_relaxed) + 1;
+            std::int64_t peak = record.peakLive.load(std::memory_order_relaxed);
+            while (peak < live && !record.peakLive.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+            }
+        } else if (event == statsFreed) {
+            typeStatsRecord<T>().live.fetch_sub(1, std::memory_order_relaxed);
+        }
+#else
+        (void)event;
+#endif
+    }
+
+    //attribute the CAS retries of the count operation that just finished to T
+    template <typename T>
+    inline void collectCasRetries() {
+#if SHAREDPTR_ENABLE_STATS
+        std::uint64_t& pending = pendingCasRetries();
+        if (pending != 0) {
+            countThreadEvent<T>(statsCasRetry, pending);
+            pending = 0;
+        }
+#endif
+    }
+}
+
+//report API, usable whether or not stats are compiled in, without them there is simply nothing to report
+class RefCountStats {
+    public:
+        static bool enabled() {
+            return SHAREDPTR_ENABLE_STATS != 0;
+        }
+
+        //totals for every type that recorded anything, the sum is exact once the threads involved are quiet
+        static std::vector<TypeStats> collect() {
+            std::vector<TypeStats> result;
+            detail::StatsRegistry& registry = detail::statsRegistry();
+            std::lock_guard<std::mutex> guard(registry.mtx);
+            for (detail::TypeStatsRecord* record = registry.types; record != nullptr; record = record->next) {
+                std::uint64_t events[detail::statsEventCount];
+                for (int i = 0; i < detail::statsEventCount; ++i) {
+                    events[i] = record->retired[i].load(std::memory_order_relaxed);
+                }
+                for (detail::ThreadStats* stats = record->threads.load(std::memory_order_acquire); stats != nullptr; stats = stats->next) {
+                    for (int i = 0; i < detail::statsEventCount; ++i) {
+                        events[i] += stats->events[i].load(std::memory_order_relaxed);
+                    }
+                }
+                result.push_back(TypeStats{record->name, record->live.load(std::memory_order_relaxed), record->peakLive.load(std::memory_order_relaxed),
+                                           events[detail::statsCreated], events[detail::statsCopied], events[detail::statsMoved], events[detail::statsReset],
+                                           events[detail::statsReleased], events[detail::statsFreed], events[detail::statsCasRetry]});
+            }
+            return result;
+        }
+
+        //totals for one type
+        template <typename T>
+        static TypeStats collect() {
+            const char* name = typeid(T).name();
+            for (const TypeStats& stats : collect()) {
+                if (std::strcmp(stats.type, name) == 0) {
+                    return stats;
+                }
+            }
+            return TypeStats{name, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        }
+
+        //one line per type, copies far above creations point at handles passed by value where a move or reference would do
+        static void dump(std::ostream& out) {
+            if (!enabled()) {
+                out << "SharedPtr stats are disabled, build with SHAREDPTR_ENABLE_STATS=1" << std::endl;
+                return;
+            }
+            for (const TypeStats& stats : collect()) {
+                out << demangle(stats.type) << ": live " << stats.live << " (peak " << stats.peakLive << "), created " << stats.created
+                    << ", copies " << stats.copies << ", moves " << stats.moves << ", resets " << stats.resets << ", releases " << stats.releases
+                    << ", frees " << stats.frees << ", CAS retries " << stats.casRetries << std::endl;
+            }
+        }
+
+    private:
+        static std::string demangle(const char* name) {
+#if defined(__GNUG__)
+            int status = 0;
+            char* readable = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+            if (status == 0 && readable != nullptr) {
+                std::string result(readable);
+                std::free(readable);
+                return result;
+            }
+#endif
+            return name;
+        }
+};
+
+#endif // REF_COUNT_STATS_H
@@ -0,0 +1,196 @@
+#ifndef REF_COUNTED_H
+#define REF_COUNTED_H
+
+#include "SharedPtr.h"
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+/* Intrusive reference counting, for small objects that exist in large numbers, such as AST or message nodes: the
+* object derives from RefCounted<T> and embeds its own count, and SharedPtr<T, Intrusive<>> is a single pointer with
+* no control block. A copy touches the object's own cache line instead of a separate block, and creating an object
+* is one allocation however it is done, MakeShared<T, Intrusive<>>(args...) or SharedPtr<T, Intrusive<>>(new T).
+*
+*   struct Node : RefCounted<Node> {
+*       SharedPtr<Node, Intrusive<>> left, right;
+*   };
+*
+* The argument of Intrusive picks how the embedded count is updated, MultiThreaded by default, SingleThreaded or
+* Sharded<N> work the same way. Since the object carries its count, a raw pointer to an owned object can always be
+* turned back into an owner, which SharedFromThis() does without any lookup.
+*
+* What the control block provided is given up: there are no WeakPtrs, no deleters or allocators (the last owner calls
+* delete), and aliasing or casting only works between pointers to the same object. The object is deleted through
+* the T of RefCounted<T>, so classes derived from T and owned through SharedPtr<T, ...> need a virtual destructor.
+*/
+template <typename Counting>
+struct Intrusive {};
+
+template <typename T, typename Counting = MultiThreaded>
+class RefCounted {
+    private:
+        //starts at zero, the first SharedPtr to adopt the object takes the first reference
+        mutable typename Counting::Count refCount;
+
+        void acquireRef() const {
+            this->refCount.increment();
+        }
+
+        void releaseRef() const {
+            if (this->refCount.decrement()) {
+                T* object = const_cast<T*>(static_cast<const T*>(this));
+                if (detail::DefersDestruction<T, Counting>::value) {
+                    Reclaimer::instance().defer(object, &RefCounted::deleteObject);
+                    return;
+                }
+                delete object;
+            }
+        }
+
+        static void deleteObject(void* object) {
+            delete static_cast<T*>(object);
+        }
+
+        template <typename U, typename P>
+        friend class SharedPtr;
+    protected:
+        RefCounted() : refCount(0) {
+            detail::recordEvent<T>(detail::statsCreated);
+        }
+        //a copy is a new object that nothing owns yet
+        RefCounted(const RefCounted&) : refCount(0) {
+            detail::recordEvent<T>(detail::statsCreated);
+        }
+        RefCounted& operator=(const RefCounted&) {
+            return *this;
+        }
+        ~RefCounted() {
+            detail::recordEvent<T>(detail::statsFreed);
+        }
+    public:
+        SharedPtr<T, Intrusive<Counting>> SharedFromThis() {
+            return SharedPtr<T, Intrusive<Counting>>(static_cast<T*>(this));
+        }
+        SharedPtr<const T, Intrusive<Counting>> SharedFromThis() const {
+            return SharedPtr<const T, Intrusive<Counting>>(static_cast<const T*>(this));
+        }
+};
+
+/* SharedPtr for objects deriving from RefCounted, a single pointer. The interface is the one of SharedPtr minus what
+* needs a control block, so code can switch a type to intrusive counting by changing the policy argument.
+*/
+template <typename T, typename Counting>
+class SharedPtr<T, Intrusive<Counting>> {
+    public:
+        typedef T element_type;
+    private:
+        T* ptr;
+
+        template <typename U, typename P>
+        friend class SharedPtr;
+    public:
+        constexpr SharedPtr() noexcept : ptr(nullptr) {}
+        constexpr SharedPtr(std::nullptr_t) noexcept : ptr(nullptr) {}
+        //adopting the same object twice is fine, both handles add to the one count in the object
+        SharedPtr(T* ptr) : ptr(ptr) {
+            acquire();
+        }
+
+        /* ptr must be the object owner points to, possibly as another type, which is what the pointer casts pass.
+        * There is no separate count to alias, ptr's own count is the one that is used.
+        */
+        template <typename U>
+        SharedPtr(const SharedPtr<U, Intrusive<Counting>> & owner, T* ptr) : ptr(owner.ptr != nullptr ? ptr : nullptr) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        template <typename U>
+        SharedPtr(SharedPtr<U, Intrusive<Counting>> && owner, T* ptr) noexcept : ptr(owner.ptr != nullptr ? ptr : nullptr) {
+            owner.ptr = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        SharedPtr(const SharedPtr<U, Intrusive<Counting>> & obj) : ptr(obj.ptr) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        SharedPtr(SharedPtr<U, Intrusive<Counting>> && obj) noexcept : ptr(obj.ptr) {
+            obj.ptr = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+
+        SharedPtr(const SharedPtr & obj) : ptr(obj.ptr) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        //copy and swap, the old object may own obj (head = head->next)
+        SharedPtr& operator=(const SharedPtr & obj) {
+            SharedPtr(obj).swap(*this);
+            return *this;
+        }
+
+        SharedPtr(SharedPtr && obj) noexcept : ptr(obj.ptr) {
+            obj.ptr = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+        SharedPtr& operator=(SharedPtr && obj) noexcept {
+            SharedPtr(std::move(obj)).swap(*this);
+            return *this;
+        }
+
+        void swap(SharedPtr & obj) noexcept {
+            std::swap(this->ptr, obj.ptr);
+        }
+
+        T* operator->() const {
+            return this->ptr;
+        }
+        T& operator*() const {
+            return *this->ptr;
+        }
+
+        unsigned int getCount() const {
+            return this->ptr ? this->ptr->refCount.load() : 0;
+        }
+        T* get() const {
+            return this->ptr;
+        }
+
+        ~SharedPtr() {
+            cleanup();
+        }
+
+        void reset() noexcept {
+            cleanup();
+            this->ptr = nullptr;
+            detail::recordEvent<T>(detail::statsReset);
+        }
+        void reset(T* ptr) {
+            //adopt first, ptr may be the object this handle is about to release
+            SharedPtr replacement(ptr);
+            cleanup();
+            this->ptr = replacement.ptr;
+            replacement.ptr = nullptr;
+            detail::recordEvent<T>(detail::statsReset);
+        }
+
+    private:
+        void acquire() const {
+            if (this->ptr != nullptr) {
+                this->ptr->acquireRef();
+                detail::collectCasRetries<T>();
+            }
+        }
+
+        void cleanup() {
+            if (this->ptr != nullptr) {
+                detail::recordEvent<T>(detail::statsReleased);
+                this->ptr->releaseRef();
+                detail::collectCasRetries<T>();
+            }
+        }
+};
+
+#endif // REF_COUNTED_H
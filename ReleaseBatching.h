@@ -0,0 +1,156 @@
+#ifndef RELEASE_BATCHING_H
+#define RELEASE_BATCHING_H
+
+#include "ThreadingPolicy.h"
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/* Releases go straight to the count unless batching is switched on, either for every type by defining
+* SHAREDPTR_BATCHED_RELEASES to 1 before including SharedPtr.h, or per type by specializing BatchedReleases<T> to
+* std::true_type. For those types, a thread inside a ScopedReleaseBatching records the releases of its SharedPtrs
+* in a thread-local buffer instead of decrementing right away, merging releases of the same control block as they
+* come in. The buffer is applied when it fills, on flushReleases() and when the outermost scope ends: each block
+* gets one fetch_sub(n) for its n releases, and blocks that reach zero destroy their objects as usual, whose own
+* releases are batched in turn. Tearing down a batch of handles that share objects then costs one atomic RMW per
+* object, and a long chain of objects is freed iteratively rather than by nested destructors.
+*
+* Until the buffer is applied, released objects stay alive and their counts read high. Only the MultiThreaded
+* policy batches, the others have no single RMW to coalesce into and release inline.
+*/
+#ifndef SHAREDPTR_BATCHED_RELEASES
+#define SHAREDPTR_BATCHED_RELEASES 0
+#endif
+
+template <typename T>
+struct BatchedReleases : std::integral_constant<bool, SHAREDPTR_BATCHED_RELEASES != 0> {};
+
+namespace detail {
+    template <typename Policy>
+    struct ControlBlock;
+
+    //policies whose Count can drop several references in one RMW with decrementBy(n)
+    template <typename Policy>
+    struct CoalescesDecrements : std::false_type {};
+
+    template <>
+    struct CoalescesDecrements<MultiThreaded> : std::true_type {};
+
+    template <typename T, typename Policy>
+    struct BatchesReleases : std::integral_constant<bool, BatchedReleases<T>::value && CoalescesDecrements<Policy>::value> {};
+
+    /* The calling thread's pending releases for blocks counted by Policy, as a small open addressing table from block
+    * to the number of releases waiting for it, so repeated releases of one block are merged as they come in, with
+    * no sort when the buffer is applied. The table is applied once half its slots are taken.
+    */
+    template <typename Policy>
+    class ReleaseBuffer {
+        private:
+            static constexpr std::size_t tableSize = 256;
+            static constexpr std::size_t maxBlocks = tableSize / 2;
+            static_assert(tableSize <= 256, "slot indices are stored in a byte");
+
+            struct Slot {
+                ControlBlock<Policy>* block;
+                unsigned int releases;
+            };
+
+            //trivially destructible, and empty whenever no scope is open, so thread exit has nothing to do
+            struct State {
+                Slot slots[tableSize];
+                //taken slots in the order their blocks were first released, applied in that order to keep the block
+                //accesses as sequential as the releases were
+                std::uint8_t order[maxBlocks];
+                std::size_t used;
+                unsigned int depth;
+            };
+
+            static State& state() {
+                thread_local State current = {{}, {}, 0, 0};
+                return current;
+            }
+
+            static std::size_t slotOf(const ControlBlock<Policy>* block) {
+                std::uint64_t key = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(block)) >> 4;
+                return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 56) & (tableSize - 1);
+            }
+
+        public:
+            //record one release of block if the thread is batching, false if it is not and the caller has to release
+            static bool defer(ControlBlock<Policy>* block) {
+                State& current = state();
+                if (current.depth == 0) {
+                    return false;
+                }
+                if (current.used == maxBlocks) {
+                    flush();
+                }
+                std::size_t i = slotOf(block);
+                while (current.slots[i].block != nullptr) {
+                    if (current.slots[i].block == block) {
+                        ++current.slots[i].releases;
+                        return true;
+                    }
+                    i = (i + 1) & (tableSize - 1);
+                }
+                current.slots[i].block = block;
+                current.slots[i].releases = 1;
+                current.order[current.used++] = static_cast<std::uint8_t>(i);
+                return true;
+            }
+
+            /* Apply everything pending, one releaseMany per block. The entries are moved out first, destructors run
+            * from here release more handles into the table, and those are applied by the next round of the loop, or
+            * by a nested flush if they fill it.
+            */
+            static void flush() {
+                State& current = state();
+                while (current.used != 0) {
+                    Slot batch[maxBlocks];
+                    std::size_t size = current.used;
+                    for (std::size_t i = 0; i < size; ++i) {
+                        Slot& slot = current.slots[current.order[i]];
+                        batch[i] = slot;
+                        slot.block = nullptr;
+                    }
+                    current.used = 0;
+                    for (std::size_t i = 0; i < size; ++i) {
+                        batch[i].block->releaseMany(batch[i].releases);
+                    }
+                }
+            }
+
+            static void enter() {
+                ++state().depth;
+            }
+
+            //the outermost scope applies the table while it is still open, so releases made by the destructors it runs are batched too
+            static void leave() {
+                State& current = state();
+                if (current.depth == 1) {
+                    flush();
+                }
+                --current.depth;
+            }
+    };
+}
+
+//batches the releases of the calling thread for as long as it exists, scopes nest
+class ScopedReleaseBatching {
+    public:
+        ScopedReleaseBatching() {
+            detail::ReleaseBuffer<MultiThreaded>::enter();
+        }
+        ~ScopedReleaseBatching() {
+            detail::ReleaseBuffer<MultiThreaded>::leave();
+        }
+        ScopedReleaseBatching(const ScopedReleaseBatching&) = delete;
+        ScopedReleaseBatching& operator=(const ScopedReleaseBatching&) = delete;
+};
+
+//apply the calling thread's pending releases now, destroying objects whose last owner was among them
+inline void flushReleases() {
+    detail::ReleaseBuffer<MultiThreaded>::flush();
+}
+
+#endif // RELEASE_BATCHING_H
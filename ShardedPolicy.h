@@ -0,0 +1,227 @@
+#ifndef SHARDED_POLICY_H
+#define SHARDED_POLICY_H
+
+#include "ThreadingPolicy.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+namespace detail {
+    //stable per-thread index, handed out round robin so threads spread evenly over the shards
+    inline unsigned int threadShardIndex() {
+        static std::atomic<unsigned int> nextIndex(0);
+        thread_local unsigned int index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+}
+
+/* Opt-in policy for extremely hot shared objects such as loggers and config singletons, where every thread copying
+* the same SharedPtr makes one count's cache line bounce between cores: SharedPtr<T, Sharded<>>.
+*
+* The owner count is split into Shards cache-line padded counters plus one central counter. Copies always increment
+* the copying thread's shard, and releases decrement it while it is positive, so threads that copy and release on
+* their own shard never touch a shared cache line. Shards never go negative; a release on a thread whose shard is
+* empty is taken from the central counter instead, which may go negative because the matching copy was counted on
+* another thread's shard. The true count is central plus the sum of the shards.
+*
+* Zero is only detected through reconciliation. A release only needs to reconcile when the central counter is not
+* positive, because shards are never negative, so a positive central counter proves the object is still owned. A
+* long-lived base reference (the handle that created a singleton) therefore keeps every release on the fast path.
+* Reconciliation takes an atomic snapshot of all counters by reading them twice and checking that nothing changed in
+* between, every counter carries a version that each update bumps, so two equal reads mean the values coexisted.
+* If the snapshot sums to zero, the object is claimed by a CAS that marks the central counter dead, which fails if
+* WeakPtr::lock() slipped in an increment after the snapshot. Otherwise the reconciling thread folds its own shard into
+* the central counter so later releases see a positive central counter again, and re-checks afterwards, since a
+* release racing the fold may have read the briefly inflated central counter. That holds even when the fold loses its
+* shard to another thread sharing it and takes the increase back.
+*
+* A release keeps reading the counters after its decrement is visible, so the block must not be freed under it. Each
+* release is counted on its shard's cache line while it runs, and the thread that claims the object waits for the other
+* releases in flight, a few instructions each, before the block goes away.
+*
+* Releases and reconciliation use sequentially consistent operations: two threads each releasing on their own shard
+* and then reading the other's must not both read the stale value, or neither would see the zero. On x86-64 that
+* costs nothing over acquire/release, RMWs are locked either way and loads stay plain moves.
+*
+* Each control block grows by Shards cache lines, so this is meant for a handful of hot objects, not every object.
+*/
+template <std::size_t Shards = 16>
+struct Sharded {
+    class Count {
+        private:
+            //low 32 bits hold the count (signed for the central counter), the high bits a version bumped by every update
+            static constexpr std::uint64_t countMask = 0xFFFFFFFFull;
+            static constexpr std::uint64_t versionOne = std::uint64_t(1) << 32;
+            //set on the central counter once the object has been claimed for destruction
+            static constexpr std::uint64_t deadFlag = std::uint64_t(1) << 63;
+            static constexpr std::uint64_t versionMask = ~countMask & ~deadFlag;
+
+            struct alignas(64) Counter {
+                std::atomic<std::uint64_t> word;
+                //releases by threads on this shard that have not finished checking the counters yet
+                std::atomic<std::uint32_t> releasing;
+            };
+
+            Counter central;
+            Counter shards[Shards];
+
+            static std::int32_t countOf(std::uint64_t word) {
+                return static_cast<std::int32_t>(static_cast<std::uint32_t>(word & countMask));
+            }
+            //same version plus one, new count, flags kept
+            static std::uint64_t updated(std::uint64_t word, std::int32_t count) {
+                std::uint64_t version = ((word & versionMask) + versionOne) & versionMask;
+                return (word & deadFlag) | version | static_cast<std::uint32_t>(count);
+            }
+
+            Counter& localShard() {
+                return this->shards[detail::threadShardIndex() % Shards];
+            }
+
+            void addCentral(std::int32_t delta) {
+                std::uint64_t cur = this->central.word.load(std::memory_order_seq_cst);
+                while (!this->central.word.compare_exchange_weak(cur, updated(cur, countOf(cur) + delta), std::memory_order_seq_cst, std::memory_order_seq_cst)) {
+                    detail::noteCasRetry();
+                }
+            }
+
+            /* Move the local shard's count into the central counter, raising central first so the total never dips below
+            * the truth. Returns whether central was raised at all, even by an attempt that lost the shard to another
+            * thread and was retracted, because while it is raised the total reads high and a concurrent release may have
+            * wrongly concluded it was not the last one.
+            */
+            bool foldLocalShard() {
+                Counter& shard = localShard();
+                std::uint64_t cur = shard.word.load(std::memory_order_seq_cst);
+                bool raised = false;
+                while (countOf(cur) > 0) {
+                    std::int32_t moved = countOf(cur);
+                    addCentral(moved);
+                    raised = true;
+                    if (shard.word.compare_exchange_strong(cur, updated(cur, 0), std::memory_order_seq_cst, std::memory_order_seq_cst)) {
+                        return true;
+                    }
+                    detail::noteCasRetry();
+                    addCentral(-moved);
+                }
+                return raised;
+            }
+
+            //true if this thread claimed the object after seeing a consistent snapshot summing to zero
+            bool reconcile() {
+                std::uint64_t first[Shards + 1];
+                while (true) {
+                    first[Shards] = this->central.word.load(std::memory_order_seq_cst);
+                    if (first[Shards] & deadFlag) {
+                        return false;
+                    }
+                    std::int64_t total = countOf(first[Shards]);
+                    for (std::size_t i = 0; i < Shards; ++i) {
+                        first[i] = this->shards[i].word.load(std::memory_order_seq_cst);
+                        total += countOf(first[i]);
+                    }
+                    bool consistent = this->central.word.load(std::memory_order_seq_cst) == first[Shards];
+                    for (std::size_t i = 0; consistent && i < Shards; ++i) {
+                        consistent = this->shards[i].word.load(std::memory_order_seq_cst) == first[i];
+                    }
+                    if (!consistent) {
+                        continue;
+                    }
+                    if (total != 0) {
+                        //after raising central, re-check on behalf of any release that saw it inflated
+                        if (!foldLocalShard() || countOf(this->central.word.load(std::memory_order_seq_cst)) > 0) {
+                            return false;
+                        }
+                        continue;
+                    }
+                    std::uint64_t expected = first[Shards];
+                    if (this->central.word.compare_exchange_strong(expected, expected | deadFlag, std::memory_order_seq_cst, std::memory_order_seq_cst)) {
+                        awaitReleases();
+                        return true;
+                    }
+                }
+            }
+
+            /* Releases that ended up in the snapshot may still be about to read the counters, let them finish before the
+            * block can be freed. No new ones can start, nobody owns the object any more. The claiming thread's own
+            * release is the one left on its shard.
+            */
+            void awaitReleases() {
+                Counter& mine = localShard();
+                for (std::size_t i = 0; i < Shards; ++i) {
+                    std::uint32_t own = &this->shards[i] == &mine ? 1 : 0;
+                    while (this->shards[i].releasing.load(std::memory_order_seq_cst) != own) {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+
+        public:
+            explicit Count(unsigned int value) {
+                this->central.word.store(static_cast<std::uint32_t>(value), std::memory_order_relaxed);
+                for (std::size_t i = 0; i < Shards; ++i) {
+                    this->shards[i].word.store(0, std::memory_order_relaxed);
+                    this->shards[i].releasing.store(0, std::memory_order_relaxed);
+                }
+            }
+
+            void increment() {
+                localShard().word.fetch_add(versionOne + 1, std::memory_order_relaxed);
+            }
+
+            //goes through the central counter, so a successful CAS here always invalidates a concurrent snapshot
+            bool incrementIfNonZero() {
+                std::uint64_t cur = this->central.word.load(std::memory_order_relaxed);
+                while (!(cur & deadFlag)) {
+                    if (this->central.word.compare_exchange_weak(cur, updated(cur, countOf(cur) + 1), std::memory_order_acquire, std::memory_order_relaxed)) {
+                        return true;
+                    }
+                    detail::noteCasRetry();
+                }
+                return false;
+            }
+
+            bool decrement() {
+                Counter& shard = localShard();
+                //announced before the decrement, so whoever sees the count reach zero also sees this release in flight
+                shard.releasing.fetch_add(1, std::memory_order_seq_cst);
+                std::uint64_t cur = shard.word.load(std::memory_order_seq_cst);
+                bool taken = false;
+                while (countOf(cur) > 0) {
+                    if (shard.word.compare_exchange_weak(cur, updated(cur, countOf(cur) - 1), std::memory_order_seq_cst, std::memory_order_seq_cst)) {
+                        taken = true;
+                        break;
+                    }
+                    detail::noteCasRetry();
+                }
+                if (!taken) {
+                    addCentral(-1);
+                }
+                //shards are never negative, so a positive central counter means someone still owns the object
+                if (countOf(this->central.word.load(std::memory_order_seq_cst)) > 0 || !reconcile()) {
+                    //the last access to the block, a claiming thread waits for it before freeing
+                    shard.releasing.fetch_sub(1, std::memory_order_seq_cst);
+                    return false;
+                }
+                return true;
+            }
+
+            //a single pass over the counters, exact when nothing is changing and a best effort otherwise
+            unsigned int load() const {
+                std::uint64_t centralWord = this->central.word.load(std::memory_order_acquire);
+                if (centralWord & deadFlag) {
+                    return 0;
+                }
+                std::int64_t total = countOf(centralWord);
+                for (std::size_t i = 0; i < Shards; ++i) {
+                    total += countOf(this->shards[i].word.load(std::memory_order_acquire));
+                }
+                return total > 0 ? static_cast<unsigned int>(total) : 0;
+            }
+    };
+    //observers are rare on the objects this policy is for, a plain atomic count is enough
+    typedef MultiThreaded::Count WeakCount;
+};
+
+#endif // SHARDED_POLICY_H
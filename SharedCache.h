@@ -0,0 +1,303 @@
+#ifndef SHARED_CACHE_H
+#define SHARED_CACHE_H
+
+#include "SharedPtr.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* Concurrent cache of immutable objects by key, holding each value as a SharedPtr<T>. Keys are spread over shards
+* that each have their own mutex, so lookups of different keys rarely meet on a lock, and a hit costs the shard lock
+* plus the increment of the copy handed back.
+*
+* getOrCreate(key, factory) constructs a missing value with factory() outside the lock. Only one thread runs the
+* factory for a key at a time: others asking for the same key wait for its result instead of building a second copy.
+* If the factory throws, the exception goes to its caller and one of the waiting threads tries again.
+*
+* Each shard keeps a budget of capacity / shards cost units of strongly held values and sweeps a CLOCK hand over its
+* entries when it goes over. An entry that was used since the hand last passed loses its reference bit and stays;
+* one that was not is demoted: the cache drops its SharedPtr and keeps only a WeakPtr. A demoted value lives on for
+* as long as anybody else holds it, and a lookup that finds it still alive promotes it back without calling the
+* factory. The hand evicts demoted entries whose object is gone. Values and entries the cache drops are released after
+* the shard lock is let go, so destructors of values and keys may use the cache.
+*/
+template <typename K, typename T, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class SharedCache {
+    public:
+        struct Stats {
+            //lookups answered from the cache, including demoted values that were still alive
+            std::uint64_t hits;
+            //lookups that found nothing usable, each getOrCreate() miss ran the factory once
+            std::uint64_t misses;
+            //hits on demoted values that were promoted back to strong
+            std::uint64_t revivals;
+            //lookups that waited for another thread's factory instead of running their own
+            std::uint64_t coalesced;
+            //strong values demoted to weak by the CLOCK hand
+            std::uint64_t demotions;
+            //demoted entries removed because their object was gone
+            std::uint64_t evictions;
+        };
+
+    private:
+        struct Entry {
+            //the key in the index, which never moves while the entry is in it
+            const K* key;
+            //held while the entry is within the budget, empty once demoted or while loading
+            SharedPtr<T> strong;
+            WeakPtr<T> weak;
+            std::size_t cost;
+            //set on every hit, cleared by the CLOCK hand
+            bool referenced;
+            //a thread is running the factory for this key
+            bool loading;
+            //neighbours in the order the CLOCK hand visits entries
+            Entry* prev;
+            Entry* next;
+
+            Entry() : key(nullptr), cost(0), referenced(false), loading(true), prev(nullptr), next(nullptr) {}
+        };
+
+        struct Shard {
+            std::mutex mtx;
+            //woken whenever a load finishes or fails
+            std::condition_variable loaded;
+            //the entries live in the index itself and are linked into the CLOCK ring through their own pointers
+            std::unordered_map<K, Entry, Hash, KeyEqual> index;
+            Entry* first;
+            Entry* last;
+            //next entry the hand looks at, nullptr to start over from first
+            Entry* hand;
+            std::size_t strongCost;
+            std::size_t budget;
+            Stats stats;
+
+            Shard() : first(nullptr), last(nullptr), hand(nullptr), strongCost(0), budget(0), stats{0, 0, 0, 0, 0, 0} {}
+        };
+
+        typedef typename std::unordered_map<K, Entry, Hash, KeyEqual>::node_type Node;
+
+        //what a call takes out of the cache under the shard lock, declared before the lock so it is destroyed after it
+        struct Dropped {
+            std::vector<SharedPtr<T>> values;
+            std::vector<Node> entries;
+        };
+
+        std::unique_ptr<Shard[]> shards;
+        std::size_t numShards;
+        Hash hash;
+
+        Shard& shardFor(const K& key) {
+            //mix the hash so identity hashes of small integers spread out, then scale its top 32 bits to the shard count without a division
+            std::uint64_t mixed = static_cast<std::uint64_t>(this->hash(key)) * 0x9E3779B97F4A7C15ull;
+            return this->shards[((mixed >> 32) * this->numShards) >> 32];
+        }
+
+        //a new loading entry for key, linked in just behind the hand so it is the last entry the hand reaches
+        static Entry* insert(Shard& shard, const K& key) {
+            auto inserted = shard.index.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first;
+            Entry* entry = &inserted->second;
+            entry->key = &inserted->first;
+            entry->next = shard.hand;
+            entry->prev = shard.hand != nullptr ? shard.hand->prev : shard.last;
+            (entry->prev != nullptr ? entry->prev->next : shard.first) = entry;
+            (entry->next != nullptr ? entry->next->prev : shard.last) = entry;
+            return entry;
+        }
+
+        //unlink entry and move it out of the index into dropped, entry is not valid afterwards
+        static void remove(Shard& shard, Entry* entry, Dropped& dropped) {
+            if (shard.hand == entry) {
+                shard.hand = entry->next;
+            }
+            (entry->prev != nullptr ? entry->prev->next : shard.first) = entry->next;
+            (entry->next != nullptr ? entry->next->prev : shard.last) = entry->prev;
+            dropped.entries.push_back(shard.index.extract(*entry->key));
+        }
+
+        //a hit on an entry that is not loading, empty if it was demoted and its object is gone
+        static SharedPtr<T> take(Shard& shard, Entry& entry) {
+            if (entry.strong.get() != nullptr) {
+                entry.referenced = true;
+                return entry.strong;
+            }
+            SharedPtr<T> revived = entry.weak.lock();
+            if (revived.get() != nullptr) {
+                entry.strong = revived;
+                entry.weak.reset();
+                entry.referenced = true;
+                shard.strongCost += entry.cost;
+                ++shard.stats.revivals;
+            }
+            return revived;
+        }
+
+        //run the CLOCK hand until the shard is within its budget, moving the values and entries it drops into dropped
+        static void shrink(Shard& shard, Dropped& dropped) {
+            while (shard.strongCost > shard.budget) {
+                Entry* entry = shard.hand != nullptr ? shard.hand : shard.first;
+                shard.hand = entry->next;
+                if (entry->strong.get() != nullptr) {
+                    if (entry->referenced) {
+                        entry->referenced = false;
+                    } else {
+                        entry->weak = entry->strong;
+                        dropped.values.push_back(std::move(entry->strong));
+                        shard.strongCost -= entry->cost;
+                        ++shard.stats.demotions;
+                    }
+                } else if (!entry->loading && entry->weak.expired()) {
+                    ++shard.stats.evictions;
+                    remove(shard, entry, dropped);
+                }
+            }
+        }
+
+    public:
+        //a cache holding up to capacity cost units of strong values over numShards shards
+        explicit SharedCache(std::size_t capacity, std::size_t numShards = 16, const Hash& hash = Hash())
+            : shards(nullptr), numShards(numShards), hash(hash) {
+            if (numShards == 0) {
+                throw std::invalid_argument("SharedCache needs at least one shard");
+            }
+            this->shards.reset(new Shard[numShards]);
+            for (std::size_t i = 0; i < numShards; ++i) {
+                //the first capacity % numShards shards take one unit more, so the budgets add up to capacity
+                this->shards[i].budget = capacity / numShards + (i < capacity % numShards ? 1 : 0);
+            }
+        }
+
+        SharedCache(const SharedCache&) = delete;
+        SharedCache& operator=(const SharedCache&) = delete;
+
+        //the cached value for key, or an empty SharedPtr if there is none or its load has not finished yet
+        SharedPtr<T> get(const K& key) {
+            Dropped dropped;
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard(shard.mtx);
+            auto found = shard.index.find(key);
+            if (found != shard.index.end() && !found->second.loading) {
+                SharedPtr<T> value = take(shard, found->second);
+                if (value.get() != nullptr) {
+                    ++shard.stats.hits;
+                    shrink(shard, dropped);
+                    return value;
+                }
+            }
+            ++shard.stats.misses;
+            return SharedPtr<T>();
+        }
+
+        /* The cached value for key, built with factory() and cached at the given cost if there is none. factory returns
+        * a SharedPtr<T>, an empty one is handed back without being cached.
+        */
+        template <typename Factory>
+        SharedPtr<T> getOrCreate(const K& key, Factory&& factory, std::size_t cost = 1) {
+            Dropped dropped;
+            Shard& shard = shardFor(key);
+            std::unique_lock<std::mutex> lock(shard.mtx);
+            Entry* entry = nullptr;
+            bool waited = false;
+            while (true) {
+                auto found = shard.index.find(key);
+                if (found == shard.index.end()) {
+                    entry = insert(shard, key);
+                    break;
+                }
+                entry = &found->second;
+                if (entry->loading) {
+                    waited = true;
+                    shard.loaded.wait(lock);
+                    continue;
+                }
+                SharedPtr<T> value = take(shard, *entry);
+                if (value.get() != nullptr) {
+                    ++shard.stats.hits;
+                    shard.stats.coalesced += waited;
+                    //a revived value counts against the budget again
+                    shrink(shard, dropped);
+                    lock.unlock();
+                    return value;
+                }
+                //demoted and gone, load it again in place
+                entry->weak.reset();
+                entry->loading = true;
+                break;
+            }
+            ++shard.stats.misses;
+            lock.unlock();
+
+            SharedPtr<T> value;
+            try {
+                value = factory();
+            } catch (...) {
+                lock.lock();
+                remove(shard, entry, dropped);
+                shard.loaded.notify_all();
+                throw;
+            }
+
+            lock.lock();
+            entry->loading = false;
+            if (value.get() == nullptr) {
+                remove(shard, entry, dropped);
+            } else {
+                entry->strong = value;
+                entry->cost = cost;
+                shard.strongCost += cost;
+                shrink(shard, dropped);
+            }
+            shard.loaded.notify_all();
+            lock.unlock();
+            return value;
+        }
+
+        //drop key from the cache, values still held elsewhere stay alive, loads in progress are left to finish
+        void erase(const K& key) {
+            Dropped dropped;
+            Shard& shard = shardFor(key);
+            std::lock_guard<std::mutex> guard(shard.mtx);
+            auto found = shard.index.find(key);
+            if (found != shard.index.end() && !found->second.loading) {
+                //the entry takes its value along, released with it after the lock
+                shard.strongCost -= found->second.strong.get() != nullptr ? found->second.cost : 0;
+                remove(shard, &found->second, dropped);
+            }
+        }
+
+        //entries currently tracked, strong and demoted, a snapshot while other threads use the cache
+        std::size_t size() {
+            std::size_t total = 0;
+            for (std::size_t i = 0; i < this->numShards; ++i) {
+                std::lock_guard<std::mutex> guard(this->shards[i].mtx);
+                total += this->shards[i].index.size();
+            }
+            return total;
+        }
+
+        //counters summed over every shard
+        Stats stats() {
+            Stats total = {0, 0, 0, 0, 0, 0};
+            for (std::size_t i = 0; i < this->numShards; ++i) {
+                std::lock_guard<std::mutex> guard(this->shards[i].mtx);
+                const Stats& stats = this->shards[i].stats;
+                total.hits += stats.hits;
+                total.misses += stats.misses;
+                total.revivals += stats.revivals;
+                total.coalesced += stats.coalesced;
+                total.demotions += stats.demotions;
+                total.evictions += stats.evictions;
+            }
+            return total;
+        }
+};
+
+#endif // SHARED_CACHE_H
@@ -1,153 +1,1162 @@
 #ifndef SHARED_PTR_H
 #define SHARED_PTR_H
 
-#include <mutex>
-#include <atomic>
+#include "ControlBlockPool.h"
+#include "Reclaimer.h"
+#include "RefCountStats.h"
+#include "ReleaseBatching.h"
+#include "ThreadingPolicy.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
 #include <utility>
 
+namespace detail {
+    template <typename Policy>
+    struct ControlBlock;
+
+    /* How a block type destroys its object once the last owner is gone and frees itself once nothing references it.
+    * Each block type has one table, blockHooks, and its blocks point at it, so the table's address also tells which
+    * type a block is. The tables are writable on purpose: linkers folding identical code and read-only data (MSVC
+    * /OPT:ICF, gold and lld --icf=all) may merge two block types' functions, or tables holding them, but never
+    * writable data.
+    */
+    template <typename Policy>
+    struct BlockHooks {
+        void (*dispose)(ControlBlock<Policy>*);
+        void (*destroy)(ControlBlock<Policy>*);
+    };
+
+    template <typename Block, typename Policy>
+    BlockHooks<Policy> blockHooks = {&Block::disposeObject, &Block::destroyBlock};
+
+    /* Bookkeeping shared by every SharedPtr and WeakPtr pointing to the same object. count is the number of SharedPtr
+    * owners. weakCount is the number of WeakPtrs plus one for the owners as a group, so the block outlives the object
+    * for as long as anything can still ask it whether the object is alive. How the counts are updated is up to the
+    * threading Policy. hooks is filled in by the concrete block type, which knows how the object and the block itself
+    * were allocated.
+    */
+    template <typename Policy>
+    struct ControlBlock {
+        typename Policy::Count count;
+        typename Policy::WeakCount weakCount;
+        BlockHooks<Policy>* hooks;
+
+        explicit ControlBlock(BlockHooks<Policy>* hooks) : count(1), weakCount(1), hooks(hooks) {}
+
+        //whether this is a Block, exactly that type and not one for a derived object
+        template <typename Block>
+        bool is() const {
+            return this->hooks == &blockHooks<Block, Policy>;
+        }
+
+        //Add a reference for a new owner, the caller already holds one
+        void acquire() {
+            this->count.increment();
+        }
+
+        //Add an owner only while the object is still alive, used by WeakPtr::lock()
+        bool tryAcquire() {
+            return this->count.incrementIfNonZero();
+        }
+
+        //Drop an owner, the last one destroys the object and then gives up the owners' weak reference
+        void release() {
+            if (this->count.decrement()) {
+                finishRelease();
+            }
+        }
+
+        //Drop n owners at once, used when applying a batch of releases
+        void releaseMany(unsigned int n) {
+            if (this->count.decrementBy(n)) {
+                finishRelease();
+            }
+        }
+
+        //what the last owner does, also called by policies that only find out later that the last owner is gone
+        void finishRelease() {
+            this->hooks->dispose(this);
+            releaseWeak();
+        }
+
+        void acquireWeak() {
+            this->weakCount.increment();
+        }
+
+        void releaseWeak() {
+            //a weak count of one means no WeakPtr exists, and with no owners left none can be created, skip the RMW
+            if (this->weakCount.isOnly() || this->weakCount.decrement()) {
+                this->hooks->destroy(this);
+            }
+        }
+    };
+
+    //what SharedPtr(T*) does with the object once the last owner is gone, delete[] for arrays from new T[n]
+    template <typename T>
+    struct DefaultDelete {
+        void operator()(T* ptr) const {
+            delete ptr;
+        }
+    };
+
+    template <typename T>
+    struct DefaultDelete<T[]> {
+        void operator()(T* ptr) const {
+            delete[] ptr;
+        }
+    };
+
+    //block for objects allocated by the caller and adopted through SharedPtr(T*), the object lives in its own allocation
+    template <typename T, typename Policy>
+    struct PointerBlock : ControlBlock<Policy>, PoolAllocated<T, PointerBlock<T, Policy>> {
+        typedef typename std::remove_extent<T>::type Element;
+
+        Element* ptr;
+
+        explicit PointerBlock(Element* ptr) : ControlBlock<Policy>(&blockHooks<PointerBlock, Policy>), ptr(ptr) {}
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            Element* ptr = static_cast<PointerBlock*>(block)->ptr;
+            if (DefersDestruction<T, Policy>::value) {
+                //the object lives in its own allocation, the block can go right away
+                Reclaimer::instance().defer(ptr, &PointerBlock::deleteObject);
+                return;
+            }
+            deleteObject(ptr);
+        }
+
+        static void deleteObject(void* object) {
+            recordEvent<T>(statsFreed);
+            DefaultDelete<T>()(static_cast<Element*>(object));
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            delete static_cast<PointerBlock*>(block);
+        }
+    };
+
+    /* block for MakeShared, the object is constructed right after the counts so both share one allocation and cache line.
+    * With no WeakPtr around, the object and the block go away together, otherwise the memory is held until the last
+    * WeakPtr lets go.
+    */
+    template <typename T, typename Policy>
+    struct InplaceBlock : ControlBlock<Policy>, PoolAllocated<T, InplaceBlock<T, Policy>> {
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        InplaceBlock() : ControlBlock<Policy>(&blockHooks<InplaceBlock, Policy>) {}
+
+        T* object() {
+            return reinterpret_cast<T*>(this->storage);
+        }
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            InplaceBlock* self = static_cast<InplaceBlock*>(block);
+            if (DefersDestruction<T, Policy>::value) {
+                //an extra weak reference keeps the storage around until the reclaimer has destroyed the object
+                self->acquireWeak();
+                Reclaimer::instance().defer(self, &InplaceBlock::reclaimObject);
+                return;
+            }
+            recordEvent<T>(statsFreed);
+            self->object()->~T();
+        }
+
+        static void reclaimObject(void* block) {
+            InplaceBlock* self = static_cast<InplaceBlock*>(block);
+            recordEvent<T>(statsFreed);
+            self->object()->~T();
+            self->releaseWeak();
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            delete static_cast<InplaceBlock*>(block);
+        }
+    };
+
+    //holds a deleter or allocator inside a block, empty ones are a base class so they take no space, Slot tells two apart
+    template <typename V, int Slot, bool Empty = std::is_empty<V>::value && !std::is_final<V>::value>
+    struct StoredValue : private V {
+        explicit StoredValue(const V& value) : V(value) {}
+        V& get() {
+            return *this;
+        }
+    };
+
+    template <typename V, int Slot>
+    struct StoredValue<V, Slot, false> {
+        V value;
+        explicit StoredValue(const V& value) : value(value) {}
+        V& get() {
+            return this->value;
+        }
+    };
+
+    //allocate and construct a block through a copy of alloc rebound to the block type
+    template <typename Block, typename Alloc, typename... Args>
+    Block* allocateBlock(const Alloc& alloc, Args&&... args) {
+        typedef typename std::allocator_traits<Alloc>::template rebind_alloc<Block> BlockAlloc;
+        BlockAlloc blockAlloc(alloc);
+        Block* block = std::allocator_traits<BlockAlloc>::allocate(blockAlloc, 1);
+        try {
+            ::new (static_cast<void*>(block)) Block(std::forward<Args>(args)...);
+        } catch (...) {
+            std::allocator_traits<BlockAlloc>::deallocate(blockAlloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
+    //the allocator is copied out first, it lives in the block being freed
+    template <typename Block>
+    void deallocateBlock(Block* block) {
+        typedef typename std::allocator_traits<typename Block::Allocator>::template rebind_alloc<Block> BlockAlloc;
+        BlockAlloc blockAlloc(block->allocator());
+        block->~Block();
+        std::allocator_traits<BlockAlloc>::deallocate(blockAlloc, block, 1);
+    }
+
+    /* block for SharedPtr(T*, Deleter[, Alloc]), the object is released by calling the deleter, which is stored in the
+    * block together with the allocator the block itself came from. The common SharedPtr(T*) keeps using PointerBlock.
+    */
+    template <typename T, typename Deleter, typename Alloc, typename Policy>
+    struct DeleterBlock : ControlBlock<Policy>, StoredValue<Deleter, 0>, StoredValue<Alloc, 1> {
+        typedef Alloc Allocator;
+        typedef typename std::remove_extent<T>::type Element;
+
+        Element* ptr;
+
+        DeleterBlock(Element* ptr, const Deleter& deleter, const Alloc& alloc)
+            : ControlBlock<Policy>(&blockHooks<DeleterBlock, Policy>), StoredValue<Deleter, 0>(deleter),
+              StoredValue<Alloc, 1>(alloc), ptr(ptr) {}
+
+        Deleter& deleter() {
+            return this->StoredValue<Deleter, 0>::get();
+        }
+        Alloc& allocator() {
+            return this->StoredValue<Alloc, 1>::get();
+        }
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            DeleterBlock* self = static_cast<DeleterBlock*>(block);
+            if (DefersDestruction<T, Policy>::value) {
+                //the deleter lives in the block, so the block has to wait for the reclaimer too
+                self->acquireWeak();
+                Reclaimer::instance().defer(self, &DeleterBlock::reclaimObject);
+                return;
+            }
+            self->deleteObject();
+        }
+
+        static void reclaimObject(void* block) {
+            DeleterBlock* self = static_cast<DeleterBlock*>(block);
+            self->deleteObject();
+            self->releaseWeak();
+        }
+
+        void deleteObject() {
+            recordEvent<T>(statsFreed);
+            deleter()(this->ptr);
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            deallocateBlock(static_cast<DeleterBlock*>(block));
+        }
+    };
+
+    /* block for AllocateShared, laid out like InplaceBlock but allocated through Alloc, which also constructs and destroys
+    * the object, so a std::pmr::polymorphic_allocator passes its memory resource on to members that take one.
+    */
+    template <typename T, typename Alloc, typename Policy>
+    struct AllocInplaceBlock : ControlBlock<Policy>, StoredValue<Alloc, 0> {
+        typedef Alloc Allocator;
+        typedef typename std::allocator_traits<Alloc>::template rebind_alloc<typename std::remove_cv<T>::type> ObjectAlloc;
+
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        explicit AllocInplaceBlock(const Alloc& alloc)
+            : ControlBlock<Policy>(&blockHooks<AllocInplaceBlock, Policy>), StoredValue<Alloc, 0>(alloc) {}
+
+        T* object() {
+            return reinterpret_cast<T*>(this->storage);
+        }
+        Alloc& allocator() {
+            return this->StoredValue<Alloc, 0>::get();
+        }
+
+        template <typename... Args>
+        void constructObject(Args&&... args) {
+            ObjectAlloc objectAlloc(allocator());
+            std::allocator_traits<ObjectAlloc>::construct(objectAlloc, object(), std::forward<Args>(args)...);
+        }
+
+        void destroyObject() {
+            recordEvent<T>(statsFreed);
+            ObjectAlloc objectAlloc(allocator());
+            std::allocator_traits<ObjectAlloc>::destroy(objectAlloc, object());
+        }
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            AllocInplaceBlock* self = static_cast<AllocInplaceBlock*>(block);
+            if (DefersDestruction<T, Policy>::value) {
+                self->acquireWeak();
+                Reclaimer::instance().defer(self, &AllocInplaceBlock::reclaimObject);
+                return;
+            }
+            self->destroyObject();
+        }
+
+        static void reclaimObject(void* block) {
+            AllocInplaceBlock* self = static_cast<AllocInplaceBlock*>(block);
+            self->destroyObject();
+            self->releaseWeak();
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            deallocateBlock(static_cast<AllocInplaceBlock*>(block));
+        }
+    };
+
+    /* block for SharedPtr::fromStd(), which owns the object through the std::shared_ptr it was handed, so the object
+    * lives for as long as owners on either side do. toStd() recognizes the block by its hooks table and hands that
+    * std::shared_ptr back out instead of wrapping it a second time.
+    */
+    template <typename T, typename Policy>
+    struct StdBlock : ControlBlock<Policy>, PoolAllocated<T, StdBlock<T, Policy>> {
+        std::shared_ptr<T> owner;
+
+        explicit StdBlock(std::shared_ptr<T>&& owner) : ControlBlock<Policy>(&blockHooks<StdBlock, Policy>), owner(std::move(owner)) {}
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            StdBlock* self = static_cast<StdBlock*>(block);
+            if (DefersDestruction<T, Policy>::value) {
+                //this may be the std side's last reference, which would destroy the object, so wait for the reclaimer
+                self->acquireWeak();
+                Reclaimer::instance().defer(self, &StdBlock::reclaimObject);
+                return;
+            }
+            self->releaseOwner();
+        }
+
+        static void reclaimObject(void* block) {
+            StdBlock* self = static_cast<StdBlock*>(block);
+            self->releaseOwner();
+            self->releaseWeak();
+        }
+
+        void releaseOwner() {
+            recordEvent<T>(statsFreed);
+            this->owner.reset();
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            delete static_cast<StdBlock*>(block);
+        }
+
+        /* the std::shared_ptr block adopted if it is a StdBlock, otherwise nullptr. Kept out of line: inlined next to
+        * MakeShared, GCC sees the smaller block allocated and flags the read of owner in the branch the check rules out.
+        */
+#if defined(_MSC_VER)
+        __declspec(noinline)
+#elif defined(__GNUC__)
+        __attribute__((noinline))
+#endif
+        static const std::shared_ptr<T>* ownerOf(ControlBlock<Policy>* block) {
+            return block->template is<StdBlock>() ? &static_cast<StdBlock*>(block)->owner : nullptr;
+        }
+    };
+
+    //deleter of the std::shared_ptrs SharedPtr::toStd() makes, holding the SharedPtr owner that keeps the object alive
+    template <typename T, typename Policy>
+    struct StdOwner;
+
+    //arrays from MakeSharedArray start on a cache line, which is also what 512-bit aligned vector loads need
+    constexpr std::size_t defaultArrayAlignment = 64;
+
+    /* block for MakeSharedArray, the count and the elements share one allocation. The elements start at the first
+    * multiple of the requested alignment past the block header, and the allocation itself is made with that alignment,
+    * so the array start is aligned however large the header is. T is the element type.
+    */
+    template <typename T, typename Policy>
+    struct ArrayBlock : ControlBlock<Policy> {
+        std::size_t length;
+        std::size_t alignment;
+
+        ArrayBlock(std::size_t length, std::size_t alignment)
+            : ControlBlock<Policy>(&blockHooks<ArrayBlock, Policy>), length(length), alignment(alignment) {}
+
+        static std::size_t elementsOffset(std::size_t alignment) {
+            return (sizeof(ArrayBlock) + alignment - 1) / alignment * alignment;
+        }
+
+        T* elements() {
+            return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(this) + elementsOffset(this->alignment));
+        }
+
+        //raw storage for a block of length elements, nothing constructed yet except the block header
+        static ArrayBlock* allocate(std::size_t length, std::size_t alignment) {
+            if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+                throw std::invalid_argument("MakeSharedArray alignment must be a power of two");
+            }
+            if (alignment < alignof(T)) {
+                alignment = alignof(T);
+            }
+            if (alignment < alignof(ArrayBlock)) {
+                alignment = alignof(ArrayBlock);
+            }
+            std::size_t offset = elementsOffset(alignment);
+            if (length > (static_cast<std::size_t>(-1) - offset) / sizeof(T)) {
+                throw std::bad_array_new_length();
+            }
+            void* memory = ::operator new(offset + length * sizeof(T), std::align_val_t(alignment));
+            return ::new (memory) ArrayBlock(length, alignment);
+        }
+
+        static void deallocate(ArrayBlock* block) {
+            std::size_t alignment = block->alignment;
+            block->~ArrayBlock();
+            ::operator delete(static_cast<void*>(block), std::align_val_t(alignment));
+        }
+
+        //construct every element, value-initialized or, for overwrite, default-initialized, which leaves trivial types untouched
+        void constructElements(bool forOverwrite) {
+            T* first = elements();
+            std::size_t constructed = 0;
+            try {
+                for (; constructed < this->length; ++constructed) {
+                    if (forOverwrite) {
+                        ::new (static_cast<void*>(first + constructed)) T;
+                    } else {
+                        ::new (static_cast<void*>(first + constructed)) T();
+                    }
+                }
+            } catch (...) {
+                destroyElements(constructed);
+                throw;
+            }
+        }
+
+        //destroy the first count elements, last to first like delete[]
+        void destroyElements(std::size_t count) {
+            if (!std::is_trivially_destructible<T>::value) {
+                T* first = elements();
+                while (count != 0) {
+                    first[--count].~T();
+                }
+            }
+        }
+
+        static void disposeObject(ControlBlock<Policy>* block) {
+            ArrayBlock* self = static_cast<ArrayBlock*>(block);
+            if (DefersDestruction<T[], Policy>::value) {
+                self->acquireWeak();
+                Reclaimer::instance().defer(self, &ArrayBlock::reclaimObject);
+                return;
+            }
+            recordEvent<T[]>(statsFreed);
+            self->destroyElements(self->length);
+        }
+
+        static void reclaimObject(void* block) {
+            ArrayBlock* self = static_cast<ArrayBlock*>(block);
+            recordEvent<T[]>(statsFreed);
+            self->destroyElements(self->length);
+            self->releaseWeak();
+        }
+
+        static void destroyBlock(ControlBlock<Policy>* block) {
+            deallocate(static_cast<ArrayBlock*>(block));
+        }
+    };
+
+    //element count carried by SharedPtr<T[]> and WeakPtr<T[]>, an empty base for every other T so their handles stay two pointers
+    template <typename T>
+    struct ArrayLength {
+        ArrayLength() {}
+        explicit ArrayLength(std::size_t) {}
+        std::size_t length() const {
+            return 0;
+        }
+        void setLength(std::size_t) {}
+    };
+
+    template <typename T>
+    struct ArrayLength<T[]> {
+        std::size_t elementCount;
+        ArrayLength() : elementCount(0) {}
+        explicit ArrayLength(std::size_t length) : elementCount(length) {}
+        std::size_t length() const {
+            return this->elementCount;
+        }
+        void setLength(std::size_t length) {
+            this->elementCount = length;
+        }
+    };
+}
+
+template <typename T, typename Policy = MultiThreaded>
+class SharedPtr;
+
+template <typename T, typename Policy = MultiThreaded, typename... Args>
+SharedPtr<T, Policy> MakeShared(Args&&... args);
+
+template <typename T, typename Policy = MultiThreaded, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args);
+
+template <typename T, typename Policy = MultiThreaded>
+SharedPtr<T[], Policy> MakeSharedArray(std::size_t length, std::size_t alignment = detail::defaultArrayAlignment);
+
+template <typename T, typename Policy = MultiThreaded>
+SharedPtr<T[], Policy> MakeSharedForOverwrite(std::size_t length, std::size_t alignment = detail::defaultArrayAlignment);
+
 template <typename T>
-class SharedPtr {
+class AtomicSharedPtr;
+
+template <typename T, typename Policy = MultiThreaded>
+class CompactSharedPtr;
+
+template <typename T, typename Policy = MultiThreaded>
+class Borrowed;
+
+template <typename T, typename Policy>
+class SharedPtrQueue;
+
+template <typename T, typename Reset, typename Policy>
+class RecyclingPool;
+
+template <typename T, typename Policy>
+class GraphWriter;
+
+template <typename T, typename Policy = MultiThreaded>
+class WeakPtr;
+
+//policy for objects that carry their own count, SharedPtr<T, Intrusive<>> is defined in RefCounted.h
+template <typename Counting = MultiThreaded>
+struct Intrusive;
+
+template <typename T, typename Policy = MultiThreaded>
+class EnableSharedFromThis;
+
+namespace detail {
+    template <typename Policy>
+    struct IsIntrusive : std::false_type {};
+
+    template <typename Counting>
+    struct IsIntrusive<Intrusive<Counting>> : std::true_type {};
+
+    //SharedPtr calls this on every object it starts owning, only objects deriving from EnableSharedFromThis do anything
+    inline void enableSharedFromThis(const volatile void*, const void*) {}
+
+    template <typename T, typename Policy>
+    void enableSharedFromThis(const EnableSharedFromThis<T, Policy>* object, ControlBlock<Policy>* block);
+}
+
+/* Thread safety follows std::shared_ptr with the default MultiThreaded policy: operations on the shared count are
+* atomic, so distinct SharedPtr instances pointing at the same object can be copied, assigned and destroyed from
+* different threads freely. A single SharedPtr instance is not synchronized, sharing one handle between threads that
+* modify it needs external synchronization. SharedPtr<T, SingleThreaded> keeps the same API with plain integer counts
+* for objects that never leave their thread.
+*
+* SharedPtr<T[]> owns an array: it is released with delete[], indexed with operator[] and carries its element count,
+* which size() returns. MakeSharedArray and MakeSharedForOverwrite put the count and the elements in one aligned block.
+*/
+template <typename T, typename Policy>
+class SharedPtr : private detail::ArrayLength<T> {
+    public:
+        typedef typename std::remove_extent<T>::type element_type;
     private:
-        T* ptr;
-        //thread safe count and access guards
-        std::atomic<unsigned int>* count;
-        mutable std::mutex mtx;
+        typedef detail::ControlBlock<Policy> Block;
+
+        element_type* ptr;
+        //counts and destroy hooks, shared between every SharedPtr pointing to the same object, nullptr when empty
+        Block* block;
+
+        /* adopt a block that already counts this SharedPtr as an owner, used by MakeShared and WeakPtr::lock(). Hooking up
+        * EnableSharedFromThis here does nothing for objects whose hook is already set, such as those lock() returns.
+        */
+        SharedPtr(element_type* ptr, Block* block, std::size_t length = 0) : detail::ArrayLength<T>(length), ptr(ptr), block(block) {
+            enableSharedFromThis();
+        }
+
+        template <typename U, typename P, typename... Args>
+        friend SharedPtr<U, P> MakeShared(Args&&... args);
+        template <typename U, typename P, typename A, typename... Args>
+        friend SharedPtr<U, P> AllocateShared(const A& alloc, Args&&... args);
+        template <typename U, typename P>
+        friend SharedPtr<U[], P> MakeSharedArray(std::size_t length, std::size_t alignment);
+        template <typename U, typename P>
+        friend SharedPtr<U[], P> MakeSharedForOverwrite(std::size_t length, std::size_t alignment);
+        template <typename U>
+        friend class AtomicSharedPtr;
+        template <typename U, typename P>
+        friend class CompactSharedPtr;
+        template <typename U, typename P>
+        friend class Borrowed;
+        template <typename U, typename P>
+        friend class SharedPtrQueue;
+        template <typename U, typename R, typename P>
+        friend class RecyclingPool;
+        template <typename U, typename P>
+        friend class GraphWriter;
+        friend class WeakPtr<T, Policy>;
+        template <typename U, typename P>
+        friend class SharedPtr;
     public:
-        //default constructor
-        SharedPtr() : ptr(nullptr), count(new std::atomic<unsigned int>(0)) {}
+        //default constructor, empty SharedPtrs own no block so creating and destroying them never allocates
+        constexpr SharedPtr() noexcept : ptr(nullptr), block(nullptr) {}
+        constexpr SharedPtr(std::nullptr_t) noexcept : ptr(nullptr), block(nullptr) {}
         //constructor with pointer
-        SharedPtr(T* ptr) : ptr(ptr), count(new std::atomic<unsigned int>(1)) {
+        SharedPtr(element_type* ptr) : ptr(ptr), block(nullptr) {
             //Check specifically if we are indirectly pointed to nullptr, in that case, treat like nullptr SharedPtr
-            if (ptr == nullptr) {
-                *this->count = 0;
+            if (ptr != nullptr) {
+                this->block = adoptPointer(ptr);
+                detail::recordEvent<T>(detail::statsCreated);
+                enableSharedFromThis();
             }
         }
+        //adopt an array from new T[length], remembering its length for size()
+        template <typename E = T, typename = typename std::enable_if<std::is_array<E>::value>::type>
+        SharedPtr(element_type* ptr, std::size_t length) : SharedPtr(ptr) {
+            this->setLength(ptr != nullptr ? length : 0);
+        }
+        /* constructor with pointer and deleter, deleter(ptr) destroys the object instead of delete, for memory from
+        * malloc, arenas or pools. The deleter is stored in the control block, so an empty one costs nothing. Like
+        * SharedPtr(T*), a null pointer gives an empty SharedPtr and the deleter is never called. If the block cannot be
+        * allocated, the deleter is called on ptr before the exception propagates.
+        */
+        template <typename Deleter, typename = decltype(std::declval<Deleter&>()(std::declval<element_type*&>()))>
+        SharedPtr(element_type* ptr, Deleter deleter) : SharedPtr(ptr, std::move(deleter), std::allocator<char>()) {}
+        //same, with the control block allocated through alloc
+        template <typename Deleter, typename Alloc, typename = decltype(std::declval<Deleter&>()(std::declval<element_type*&>()))>
+        SharedPtr(element_type* ptr, Deleter deleter, Alloc alloc) : ptr(ptr), block(nullptr) {
+            if (ptr != nullptr) {
+                try {
+                    this->block = detail::allocateBlock<detail::DeleterBlock<T, Deleter, Alloc, Policy>>(alloc, ptr, deleter, alloc);
+                } catch (...) {
+                    deleter(ptr);
+                    throw;
+                }
+                detail::recordEvent<T>(detail::statsCreated);
+                enableSharedFromThis();
+            }
+        }
+
+        /* aliasing constructor, shares ownership of owner's object but points to ptr, usually a member or element of it,
+        * so handles into a large object keep the whole object alive without a count of their own. Costs one increment
+        * and no allocation, and the rvalue overload takes over owner's reference without any increment.
+        */
+        template <typename U>
+        SharedPtr(const SharedPtr<U, Policy> & owner, element_type* ptr) : ptr(ptr), block(owner.block) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        template <typename U>
+        SharedPtr(SharedPtr<U, Policy> && owner, element_type* ptr) noexcept : ptr(ptr), block(owner.block) {
+            owner.ptr = nullptr;
+            owner.block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+
+        //converting constructors, for SharedPtr<Derived> to SharedPtr<Base> and SharedPtr<T> to SharedPtr<const T>
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        SharedPtr(const SharedPtr<U, Policy> & obj) : detail::ArrayLength<T>(obj.length()), ptr(obj.ptr), block(obj.block) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
+        }
+        template <typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+        SharedPtr(SharedPtr<U, Policy> && obj) noexcept : detail::ArrayLength<T>(obj.length()), ptr(obj.ptr), block(obj.block) {
+            obj.ptr = nullptr;
+            obj.block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
 
         //copy constructor
         /*
-        * Check to see if we are already pointing to object, if not do assignments, making sure to check for nullptr to treat as special case
+        * Share the pointer and count of obj, making sure to check for nullptr to treat as special case
         */
-        SharedPtr(const SharedPtr & obj) {
-            std::lock_guard<std::mutex> guard(obj.mtx);
-            this->ptr = obj.ptr;
-            this->count = obj.count;
-            if (obj.ptr != nullptr) {
-                (*this->count)++;
-            }
+        SharedPtr(const SharedPtr & obj) : detail::ArrayLength<T>(obj), ptr(obj.ptr), block(obj.block) {
+            acquire();
+            detail::recordEvent<T>(detail::statsCopied);
         }
+        /* copy and swap: the new reference is taken and obj read before the old object is released, so neither assigning
+        * between handles of the same object nor obj living inside the old object (head = head->next) touches freed memory
+        */
         SharedPtr& operator=(const SharedPtr & obj) {
-            //If already pointing to same object, increment count and return
-            if (this != &obj) {
-                std::lock(mtx, obj.mtx);
-                std::lock_guard<std::mutex> guard1(mtx, std::adopt_lock);
-                std::lock_guard<std::mutex> guard2(obj.mtx, std::adopt_lock);
-                if (this->ptr != nullptr) {
-                    cleanup();
-                }
-                //if not pointing to a object, just copy pointer and count
-                this->ptr = obj.ptr;
-                this->count = obj.count;
-                
-                if (obj.ptr != nullptr) {
-                    (*this->count)++;
-                }
-            }
+            SharedPtr(obj).swap(*this);
             return *this;
         }
 
         //move constructor
         /*
-        * Check to see if we are already pointing to object, if not do assignments, making sure to check for nullptr to treat as special case
-        * since it is a move, no need to worry about the count, it will remain the same
+        * Steal the pointer and count of obj, since it is a move, no need to worry about the count, it will remain the same
         */
-        SharedPtr(SharedPtr && obj) {
-            std::lock_guard<std::mutex> guard(obj.mtx);
-            this->ptr = obj.ptr;
-            this->count = obj.count;
+        SharedPtr(SharedPtr && obj) noexcept : detail::ArrayLength<T>(obj), ptr(obj.ptr), block(obj.block) {
             obj.ptr = nullptr;
-            obj.count = nullptr;
-        }
-        SharedPtr& operator=(SharedPtr && obj) {
-            if (this != &obj) {
-                std::lock(mtx, obj.mtx);
-                std::lock_guard<std::mutex> guard1(mtx, std::adopt_lock);
-                std::lock_guard<std::mutex> guard2(obj.mtx, std::adopt_lock);
-                if (this->ptr != nullptr) {
-                    cleanup();
-                }
-                this->ptr = obj.ptr;
-                this->count = obj.count;
-                obj.ptr = nullptr;
-                obj.count = nullptr;
-            }
+            obj.block = nullptr;
+            detail::recordEvent<T>(detail::statsMoved);
+        }
+        SharedPtr& operator=(SharedPtr && obj) noexcept {
+            SharedPtr(std::move(obj)).swap(*this);
             return *this;
         }
 
+        //exchange the objects of two handles without touching either count
+        void swap(SharedPtr & obj) noexcept {
+            std::swap(this->ptr, obj.ptr);
+            std::swap(this->block, obj.block);
+            std::size_t length = this->length();
+            this->setLength(obj.length());
+            obj.setLength(length);
+        }
+
         //overloaded dereference operator
-        T* operator->() const {
-            std::lock_guard<std::mutex> guard(mtx);
+        element_type* operator->() const {
             return this->ptr;
         }
-        T& operator*() const {
-            std::lock_guard<std::mutex> guard(mtx);
+        element_type& operator*() const {
             return *this->ptr;
         }
+        //element access and element count, only for SharedPtr<T[]>
+        template <typename E = T, typename = typename std::enable_if<std::is_array<E>::value>::type>
+        element_type& operator[](std::ptrdiff_t index) const {
+            return this->ptr[index];
+        }
+        template <typename E = T, typename = typename std::enable_if<std::is_array<E>::value>::type>
+        std::size_t size() const {
+            return this->length();
+        }
 
         //get count
         unsigned int getCount() const {
-            std::lock_guard<std::mutex> guard(mtx);
-            return *this->count;
+            return this->block ? this->block->count.load() : 0;
         }
         //get pointer
-        T* get() const {
-            std::lock_guard<std::mutex> guard(mtx);
+        element_type* get() const {
             return this->ptr;
         }
 
         //destructor
         ~SharedPtr() {
-            std::lock_guard<std::mutex> guard(mtx);
             cleanup();
         }
 
         //reset
-        void reset() {
-            std::lock_guard<std::mutex> guard(mtx);
-            if (this->ptr != nullptr) {
-                cleanup();
-            }
+        void reset() noexcept {
+            cleanup();
             this->ptr = nullptr;
-            this->count = new std::atomic<unsigned int>(0);
+            this->block = nullptr;
+            this->setLength(0);
+            detail::recordEvent<T>(detail::statsReset);
         }
 
-        //reset with new pointer
-        void reset(T* ptr) {
-            const std::lock_guard<std::mutex> lock(mtx);
-            if (this->ptr != nullptr) {
-                cleanup();
+        //reset with new pointer, the block is allocated before the old object is released, so a failure leaves this untouched
+        void reset(element_type* ptr) {
+            SharedPtr replacement(ptr);
+            cleanup();
+            this->ptr = replacement.ptr;
+            this->block = replacement.block;
+            this->setLength(0);
+            replacement.ptr = nullptr;
+            replacement.block = nullptr;
+            detail::recordEvent<T>(detail::statsReset);
+        }
+        //reset with new pointer and deleter, and optionally the allocator for the control block
+        template <typename Deleter, typename = decltype(std::declval<Deleter&>()(std::declval<element_type*&>()))>
+        void reset(element_type* ptr, Deleter deleter) {
+            reset(ptr, std::move(deleter), std::allocator<char>());
+        }
+        template <typename Deleter, typename Alloc, typename = decltype(std::declval<Deleter&>()(std::declval<element_type*&>()))>
+        void reset(element_type* ptr, Deleter deleter, Alloc alloc) {
+            SharedPtr replacement(ptr, std::move(deleter), std::move(alloc));
+            cleanup();
+            this->ptr = replacement.ptr;
+            this->block = replacement.block;
+            this->setLength(0);
+            replacement.ptr = nullptr;
+            replacement.block = nullptr;
+            detail::recordEvent<T>(detail::statsReset);
+        }
+
+        /* Share the object of a std::shared_ptr, for code that gets its objects from libraries speaking std::shared_ptr.
+        * A std::shared_ptr that toStd() made is unwrapped: the result shares the original block for one increment and
+        * no allocation. Any other is adopted by a new control block that takes over owner's reference, so moving owner
+        * in costs one allocation (from the pool with PooledControlBlocks<T>) and no increment. A null owner gives an
+        * empty SharedPtr.
+        */
+        static SharedPtr fromStd(std::shared_ptr<T> owner) {
+            static_assert(!std::is_array<T>::value, "fromStd only adopts single objects");
+            element_type* ptr = owner.get();
+            if (ptr == nullptr) {
+                return SharedPtr();
             }
-            this->ptr = ptr;
-            if (ptr != nullptr) {
-                this->count = new std::atomic<unsigned int>(1);
-            } else {
-                this->count = new std::atomic<unsigned int>(0);
+            if (detail::StdOwner<T, Policy>* wrapper = std::get_deleter<detail::StdOwner<T, Policy>>(owner)) {
+                return SharedPtr(wrapper->owner, ptr);
             }
+            Block* block = new detail::StdBlock<T, Policy>(std::move(owner));
+            detail::recordEvent<T>(detail::statsCreated);
+            return SharedPtr(ptr, block);
+        }
+
+        /* The object as a std::shared_ptr that keeps it alive through this SharedPtr's block, for handing objects to code
+        * speaking std::shared_ptr. A SharedPtr that fromStd() made gives back the std::shared_ptr it adopted, for one
+        * increment on the std side and no allocation. Any other is moved (or copied, for one increment) into the deleter
+        * of a new std::shared_ptr, whose control block is the one allocation, from the pool with PooledControlBlocks<T>.
+        */
+        std::shared_ptr<T> toStd() const & {
+            static_assert(!std::is_array<T>::value, "toStd only hands out single objects");
+            if (this->block == nullptr) {
+                return std::shared_ptr<T>();
+            }
+            if (const std::shared_ptr<T>* owner = detail::StdBlock<T, Policy>::ownerOf(this->block)) {
+                return std::shared_ptr<T>(*owner, this->ptr);
+            }
+            return std::shared_ptr<T>(this->ptr, detail::StdOwner<T, Policy>{*this}, detail::PoolAllocator<char, T>());
+        }
+        //same, taking over this SharedPtr's reference, which leaves it empty
+        std::shared_ptr<T> toStd() && {
+            static_assert(!std::is_array<T>::value, "toStd only hands out single objects");
+            if (this->block == nullptr || this->block->template is<detail::StdBlock<T, Policy>>()) {
+                std::shared_ptr<T> owner = static_cast<const SharedPtr&>(*this).toStd();
+                reset();
+                return owner;
+            }
+            element_type* ptr = this->ptr;
+            return std::shared_ptr<T>(ptr, detail::StdOwner<T, Policy>{std::move(*this)}, detail::PoolAllocator<char, T>());
         }
 
         private:
+            //a PointerBlock owning ptr, like std::shared_ptr, ptr is deleted if the block cannot be allocated
+            static Block* adoptPointer(element_type* ptr) {
+                try {
+                    return new detail::PointerBlock<T, Policy>(ptr);
+                } catch (...) {
+                    detail::DefaultDelete<T>()(ptr);
+                    throw;
+                }
+            }
+
+            //Add a reference for a new SharedPtr sharing this object, empty SharedPtrs have no block to count
+            void acquire() const {
+                if (this->block != nullptr) {
+                    this->block->acquire();
+                    detail::collectCasRetries<T>();
+                }
+            }
+
             /* Decrement the count to current object assigned to current SharedPtr, and remove the ptr associated with it,
-            * if the count is 1, then we are the last ptr to object, so we can delete the object.
-            * if the count is 0, ptr is pointing to a nullptr, the block should be left alone.
+            * if the count is 1, then we are the last ptr to object, so the block destroys the object and frees itself.
+            * Empty SharedPtrs have no block, so there is nothing to release. Types with batched releases leave the
+            * decrement to the thread's release buffer while a ScopedReleaseBatching is open.
             */
             void cleanup() {
-                if (count) {
-                    if (*(this->count) > 0 && --(*this->count) == 0) {
-                        delete this->ptr;
-                        delete this->count;
+                if (this->block != nullptr) {
+                    detail::recordEvent<T>(detail::statsReleased);
+                    if constexpr (detail::BatchesReleases<T, Policy>::value) {
+                        if (detail::ReleaseBuffer<Policy>::defer(this->block)) {
+                            return;
+                        }
                     }
+                    this->block->release();
+                    detail::collectCasRetries<T>();
+                }
+            }
+
+            //point a new object's EnableSharedFromThis base at its block, arrays never take part
+            void enableSharedFromThis() {
+                if (!std::is_array<T>::value) {
+                    detail::enableSharedFromThis(this->ptr, this->block);
                 }
             }
 
 };
 
-#endif // SHARED_PTR_H
\ No newline at end of file
+namespace detail {
+    template <typename T, typename Policy>
+    struct StdOwner {
+        SharedPtr<T, Policy> owner;
+
+        //the std side's last owner is gone, give up the SharedPtr reference, which may be the last one
+        void operator()(T*) {
+            this->owner.reset();
+        }
+    };
+}
+
+/* Non-owning observer of an object managed by SharedPtr. A WeakPtr keeps the control block alive but not the
+* object, so caches can hold entries without pinning them and check on lookup whether the object is still there.
+*/
+template <typename T, typename Policy>
+class WeakPtr : private detail::ArrayLength<T> {
+    private:
+        typedef detail::ControlBlock<Policy> Block;
+
+        typename std::remove_extent<T>::type* ptr;
+        //shared control block, nullptr when empty
+        Block* block;
+
+        //observe the object of a block directly, used by EnableSharedFromThis while the first owner is being set up
+        WeakPtr(typename std::remove_extent<T>::type* ptr, Block* block) : ptr(ptr), block(block) {
+            acquire();
+        }
+
+        template <typename U, typename P>
+        friend class EnableSharedFromThis;
+    public:
+        //default constructor
+        constexpr WeakPtr() noexcept : ptr(nullptr), block(nullptr) {}
+        //constructor observing the object owned by a SharedPtr
+        WeakPtr(const SharedPtr<T, Policy> & obj) : detail::ArrayLength<T>(obj.length()), ptr(obj.ptr), block(obj.block) {
+            acquire();
+        }
+
+        //copy constructor
+        WeakPtr(const WeakPtr & obj) : detail::ArrayLength<T>(obj), ptr(obj.ptr), block(obj.block) {
+            acquire();
+        }
+        /* copy and swap like SharedPtr: dropping the old block may destroy a deleter that owns whatever holds obj, so obj
+        * is copied before anything is released
+        */
+        WeakPtr& operator=(const WeakPtr & obj) {
+            WeakPtr(obj).swap(*this);
+            return *this;
+        }
+        WeakPtr& operator=(const SharedPtr<T, Policy> & obj) {
+            WeakPtr(obj).swap(*this);
+            return *this;
+        }
+
+        //move constructor
+        WeakPtr(WeakPtr && obj) noexcept : detail::ArrayLength<T>(obj), ptr(obj.ptr), block(obj.block) {
+            obj.ptr = nullptr;
+            obj.block = nullptr;
+        }
+        WeakPtr& operator=(WeakPtr && obj) noexcept {
+            WeakPtr(std::move(obj)).swap(*this);
+            return *this;
+        }
+
+        //exchange the objects observed by two WeakPtrs without touching either count
+        void swap(WeakPtr & obj) noexcept {
+            std::swap(this->ptr, obj.ptr);
+            std::swap(this->block, obj.block);
+            std::size_t length = this->length();
+            this->setLength(obj.length());
+            obj.setLength(length);
+        }
+
+        //destructor
+        ~WeakPtr() {
+            cleanup();
+        }
+
+        //reset
+        void reset() noexcept {
+            cleanup();
+            this->ptr = nullptr;
+            this->block = nullptr;
+            this->setLength(0);
+        }
+
+        //number of SharedPtrs currently owning the object
+        unsigned int use_count() const {
+            return this->block ? this->block->count.load() : 0;
+        }
+        //true once the object has been destroyed, or if there never was one
+        bool expired() const {
+            return use_count() == 0;
+        }
+        //get a SharedPtr to the object if it is still alive, or an empty SharedPtr if not, without ever taking a lock
+        SharedPtr<T, Policy> lock() const {
+            if (this->block != nullptr && this->block->tryAcquire()) {
+                detail::collectCasRetries<T>();
+                return SharedPtr<T, Policy>(this->ptr, this->block, this->length());
+            }
+            detail::collectCasRetries<T>();
+            return SharedPtr<T, Policy>();
+        }
+
+    private:
+        void acquire() const {
+            if (this->block != nullptr) {
+                this->block->acquireWeak();
+            }
+        }
+
+        void cleanup() {
+            if (this->block != nullptr) {
+                this->block->releaseWeak();
+            }
+        }
+};
+
+/* Base class for objects that need a SharedPtr to themselves, e.g. to hand one to a callback, like
+* std::enable_shared_from_this: class Session : public EnableSharedFromThis<Session>. The first SharedPtr to take
+* ownership of the object (adopting it, MakeShared or AllocateShared) records its control block in a WeakPtr inside
+* the object, so SharedFromThis() is a WeakPtr::lock() with no lookup. Calling it on an object no SharedPtr owns
+* throws std::bad_weak_ptr. The object's own WeakPtr keeps the control block, not the object, alive.
+*/
+template <typename T, typename Policy>
+class EnableSharedFromThis {
+    private:
+        mutable WeakPtr<T, Policy> weakThis;
+
+        //only the first owner counts, a second SharedPtr adopting the same object is a bug and does not take over
+        void attach(detail::ControlBlock<Policy>* block) const {
+            if (this->weakThis.expired()) {
+                this->weakThis = WeakPtr<T, Policy>(const_cast<T*>(static_cast<const T*>(this)), block);
+            }
+        }
+
+        template <typename U, typename P>
+        friend void detail::enableSharedFromThis(const EnableSharedFromThis<U, P>* object, detail::ControlBlock<P>* block);
+    protected:
+        EnableSharedFromThis() {}
+        //a copy is a different object, it is not owned by the original's SharedPtrs
+        EnableSharedFromThis(const EnableSharedFromThis&) {}
+        EnableSharedFromThis& operator=(const EnableSharedFromThis&) {
+            return *this;
+        }
+        ~EnableSharedFromThis() {}
+    public:
+        SharedPtr<T, Policy> SharedFromThis() {
+            SharedPtr<T, Policy> self = this->weakThis.lock();
+            if (self.get() == nullptr) {
+                throw std::bad_weak_ptr();
+            }
+            return self;
+        }
+        SharedPtr<const T, Policy> SharedFromThis() const {
+            SharedPtr<T, Policy> self = this->weakThis.lock();
+            if (self.get() == nullptr) {
+                throw std::bad_weak_ptr();
+            }
+            return SharedPtr<const T, Policy>(std::move(self));
+        }
+        WeakPtr<T, Policy> WeakFromThis() const {
+            return this->weakThis;
+        }
+};
+
+template <typename T, typename Policy>
+void detail::enableSharedFromThis(const EnableSharedFromThis<T, Policy>* object, ControlBlock<Policy>* block) {
+    object->attach(block);
+}
+
+/* Casts sharing the control block of obj, like the std::shared_ptr casts. The rvalue overloads hand obj's reference to
+* the result without touching the count. DynamicPointerCast returns an empty SharedPtr when the cast fails, and then
+* leaves an rvalue obj as it was.
+*/
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> StaticPointerCast(const SharedPtr<U, Policy> & obj) {
+    return SharedPtr<T, Policy>(obj, static_cast<T*>(obj.get()));
+}
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> StaticPointerCast(SharedPtr<U, Policy> && obj) {
+    T* ptr = static_cast<T*>(obj.get());
+    return SharedPtr<T, Policy>(std::move(obj), ptr);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> DynamicPointerCast(const SharedPtr<U, Policy> & obj) {
+    T* ptr = dynamic_cast<T*>(obj.get());
+    if (ptr == nullptr) {
+        return SharedPtr<T, Policy>();
+    }
+    return SharedPtr<T, Policy>(obj, ptr);
+}
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> DynamicPointerCast(SharedPtr<U, Policy> && obj) {
+    T* ptr = dynamic_cast<T*>(obj.get());
+    if (ptr == nullptr) {
+        return SharedPtr<T, Policy>();
+    }
+    return SharedPtr<T, Policy>(std::move(obj), ptr);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ConstPointerCast(const SharedPtr<U, Policy> & obj) {
+    return SharedPtr<T, Policy>(obj, const_cast<T*>(obj.get()));
+}
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> ConstPointerCast(SharedPtr<U, Policy> && obj) {
+    T* ptr = const_cast<T*>(obj.get());
+    return SharedPtr<T, Policy>(std::move(obj), ptr);
+}
+
+/* Construct a T in the same allocation as its count, halving the allocations of SharedPtr(new T(...)) and keeping
+* the object next to its count. If the constructor throws, the block is freed and the exception propagates.
+*/
+template <typename T, typename Policy, typename... Args>
+SharedPtr<T, Policy> MakeShared(Args&&... args) {
+    static_assert(!std::is_array<T>::value, "use MakeSharedArray for arrays");
+    if constexpr (detail::IsIntrusive<Policy>::value) {
+        //the count is already part of the object, there is no block to share the allocation with
+        return SharedPtr<T, Policy>(new T(std::forward<Args>(args)...));
+    } else {
+        detail::InplaceBlock<T, Policy>* block = new detail::InplaceBlock<T, Policy>();
+        try {
+            ::new (static_cast<void*>(block->storage)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            delete block;
+            throw;
+        }
+        detail::recordEvent<T>(detail::statsCreated);
+        return SharedPtr<T, Policy>(block->object(), block);
+    }
+}
+
+/* MakeShared with the block, and the object inside it, allocated through alloc, for arenas and other custom memory.
+* alloc also constructs and destroys the object, so AllocateShared<T>(std::pmr::polymorphic_allocator<T>(&arena), ...)
+* puts the whole object in the arena and hands the arena to members that are allocator-aware.
+*/
+template <typename T, typename Policy, typename Alloc, typename... Args>
+SharedPtr<T, Policy> AllocateShared(const Alloc& alloc, Args&&... args) {
+    static_assert(!detail::IsIntrusive<Policy>::value, "intrusive objects are freed with delete, allocate them with MakeShared or new");
+    typedef detail::AllocInplaceBlock<T, Alloc, Policy> Block;
+    Block* block = detail::allocateBlock<Block>(alloc, alloc);
+    try {
+        block->constructObject(std::forward<Args>(args)...);
+    } catch (...) {
+        detail::deallocateBlock(block);
+        throw;
+    }
+    detail::recordEvent<T>(detail::statsCreated);
+    return SharedPtr<T, Policy>(block->object(), block);
+}
+
+/* Array of length value-initialized Ts in the same allocation as its count, starting on an alignment boundary (a
+* power of two, raised to alignof(T) if smaller), so SIMD kernels can use aligned loads on it directly. If an element
+* constructor throws, the elements built so far are destroyed, the block is freed and the exception propagates.
+*/
+template <typename T, typename Policy>
+SharedPtr<T[], Policy> MakeSharedArray(std::size_t length, std::size_t alignment) {
+    typedef detail::ArrayBlock<T, Policy> Block;
+    Block* block = Block::allocate(length, alignment);
+    try {
+        block->constructElements(false);
+    } catch (...) {
+        Block::deallocate(block);
+        throw;
+    }
+    detail::recordEvent<T[]>(detail::statsCreated);
+    return SharedPtr<T[], Policy>(block->elements(), block, length);
+}
+
+//MakeSharedArray with default-initialized elements, trivial types are left uninitialized for the caller to fill in
+template <typename T, typename Policy>
+SharedPtr<T[], Policy> MakeSharedForOverwrite(std::size_t length, std::size_t alignment) {
+    typedef detail::ArrayBlock<T, Policy> Block;
+    Block* block = Block::allocate(length, alignment);
+    try {
+        block->constructElements(true);
+    } catch (...) {
+        Block::deallocate(block);
+        throw;
+    }
+    detail::recordEvent<T[]>(detail::statsCreated);
+    return SharedPtr<T[], Policy>(block->elements(), block, length);
+}
+
+#endif // SHARED_PTR_H
@@ -0,0 +1,89 @@
+#ifndef SHARED_PTR_QUEUE_H
+#define SHARED_PTR_QUEUE_H
+
+#include "MpmcRing.h"
+#include "SharedPtr.h"
+#include <cstddef>
+#include <type_traits>
+
+/* Bounded lock-free multi-producer multi-consumer queue of SharedPtrs, for handing work items between the threads of
+* a pool. push() moves the handle's object and control block pointers straight into a slot and pop() moves them out
+* into the caller's handle, so an item crosses the queue without a single count change, where a mutex-guarded
+* std::deque<SharedPtr<T>> pays for a lock on both ends. The slots are a detail::MpmcRing, pushBulk() and popBulk()
+* claim a whole run of them with a single CAS.
+*
+* push() and pop() never wait: they return false when the queue is full or empty, and pushes that fail leave the
+* item with the caller. Items still queued when the queue is destroyed are released then.
+*/
+template <typename T, typename Policy = MultiThreaded>
+class SharedPtrQueue {
+    private:
+        static_assert(!std::is_array<T>::value && !detail::IsIntrusive<Policy>::value,
+                      "SharedPtrQueue moves a single object and its control block, arrays and intrusive objects are not supported");
+        static_assert(!std::is_same<Policy, SingleThreaded>::value, "SharedPtrQueue hands objects to other threads, SingleThreaded counts cannot follow them");
+
+        typedef detail::ControlBlock<Policy> Block;
+
+        //an owner reference parked in the queue
+        struct Item {
+            T* ptr;
+            Block* block;
+        };
+
+        detail::MpmcRing<Item> ring;
+
+    public:
+        //a queue holding up to capacity items, which has to be a power of two
+        explicit SharedPtrQueue(std::size_t capacity) : ring(capacity) {}
+
+        SharedPtrQueue(const SharedPtrQueue&) = delete;
+        SharedPtrQueue& operator=(const SharedPtrQueue&) = delete;
+
+        //release whatever is still queued, no other thread may be using the queue
+        ~SharedPtrQueue() {
+            SharedPtr<T, Policy> item;
+            while (pop(item)) {
+                item.reset();
+            }
+        }
+
+        /* Move item into the queue, false (with item untouched) if the queue is full. An empty item is queued like any
+        * other and comes out empty.
+        */
+        bool push(SharedPtr<T, Policy>&& item) {
+            return pushBulk(&item, 1) == 1;
+        }
+
+        //move item out of the queue into out, releasing what out held, false (with out untouched) if the queue is empty
+        bool pop(SharedPtr<T, Policy>& out) {
+            return popBulk(&out, 1) == 1;
+        }
+
+        //move up to count items from items into the queue in order, returns how many went in, those from the front
+        std::size_t pushBulk(SharedPtr<T, Policy>* items, std::size_t count) {
+            return this->ring.push(count, [items](std::size_t i, Item& slot) {
+                slot.ptr = items[i].ptr;
+                slot.block = items[i].block;
+                items[i].ptr = nullptr;
+                items[i].block = nullptr;
+            });
+        }
+
+        //move up to count items out of the queue into out, oldest first, returns how many came out
+        std::size_t popBulk(SharedPtr<T, Policy>* out, std::size_t count) {
+            return this->ring.pop(count, [out](std::size_t i, Item& slot) {
+                out[i] = SharedPtr<T, Policy>(slot.ptr, slot.block);
+            });
+        }
+
+        std::size_t capacity() const {
+            return this->ring.capacity();
+        }
+
+        //items queued right now, only a snapshot while other threads push and pop
+        std::size_t approximateSize() const {
+            return this->ring.approximateSize();
+        }
+};
+
+#endif // SHARED_PTR_QUEUE_H
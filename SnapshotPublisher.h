@@ -0,0 +1,117 @@
+#ifndef SNAPSHOT_PUBLISHER_H
+#define SNAPSHOT_PUBLISHER_H
+
+#include "SharedPtr.h"
+#include "AtomicSharedPtr.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* Read-mostly publication of immutable snapshots, for config and routing tables that every request reads and a
+* writer replaces a few times a minute. Writers publish(snapshot), readers call read().
+*
+* Each thread keeps its own handle to the last snapshot it saw of each publisher, tagged with the version it was
+* published under. read() compares that version against the publisher's with one relaxed load and returns the
+* cached handle when they match, so the read path writes nothing shared and never touches a count. Only the
+* first read after a publish copies the new snapshot out of the publisher's AtomicSharedPtr.
+*
+* Reclamation needs nothing beyond the counts: a snapshot is freed when the publisher and every thread that cached
+* it have moved on. A thread moves on at its next read(), so an old snapshot stays alive for as long as some thread
+* that read it before the publish has not read again (or exited). Cached snapshots of a destroyed publisher are
+* released by the thread's next read() that has to refresh or add a snapshot, or when the thread exits.
+*/
+template <typename T>
+class SnapshotPublisher {
+    private:
+        struct State {
+            AtomicSharedPtr<T> current;
+            //bumped after every publish, readers refresh their cached handle when it moves
+            std::atomic<std::uint64_t> version;
+
+            explicit State(SharedPtr<T> initial) : current(std::move(initial)), version(1) {}
+        };
+
+        //one thread's last snapshot of one publisher
+        struct CachedSnapshot {
+            State* state;
+            //keeps the block holding state allocated, so no later publisher can reuse the address while this entry names it
+            WeakPtr<State> owner;
+            std::uint64_t version;
+            SharedPtr<T> snapshot;
+
+            explicit CachedSnapshot(const SharedPtr<State>& state) : state(state.get()), owner(state), version(0) {}
+        };
+
+        //the entries never move, so a reference read() returned stays valid while its publisher is alive
+        typedef std::vector<std::unique_ptr<CachedSnapshot>> ThreadCache;
+
+        SharedPtr<State> state;
+
+        static ThreadCache& threadCache() {
+            thread_local ThreadCache cache;
+            return cache;
+        }
+
+        //drop the snapshots this thread cached of publishers that are gone
+        static void sweep(ThreadCache& cache) {
+            cache.erase(std::remove_if(cache.begin(), cache.end(), [](const std::unique_ptr<CachedSnapshot>& entry) { return entry->owner.expired(); }),
+                        cache.end());
+        }
+
+        //the version is read first, so a publish in between leaves a newer snapshot under an older version and costs one more refresh
+        const SharedPtr<T>& refresh(CachedSnapshot& entry) const {
+            entry.version = this->state->version.load(std::memory_order_acquire);
+            entry.snapshot = this->state->current.load();
+            return entry.snapshot;
+        }
+
+    public:
+        //a publisher holding initial, which may be empty
+        explicit SnapshotPublisher(SharedPtr<T> initial = SharedPtr<T>()) : state(MakeShared<State>(std::move(initial))) {}
+
+        SnapshotPublisher(const SnapshotPublisher&) = delete;
+        SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+        //replace the snapshot, readers pick it up on their next read()
+        void publish(SharedPtr<T> snapshot) {
+            this->state->current.store(std::move(snapshot));
+            this->state->version.fetch_add(1, std::memory_order_release);
+        }
+
+        /* The current snapshot, as the calling thread's cached handle. The reference stays valid until the thread calls
+        * read() on this publisher again or the publisher is destroyed, copy it to keep the snapshot longer.
+        */
+        const SharedPtr<T>& read() const {
+            State* state = this->state.get();
+            ThreadCache& cache = threadCache();
+            for (const std::unique_ptr<CachedSnapshot>& entry : cache) {
+                if (entry->state == state) {
+                    if (entry->version != state->version.load(std::memory_order_relaxed)) {
+                        //sweeping moves the unique_ptrs around, not the entries they own
+                        CachedSnapshot& stale = *entry;
+                        sweep(cache);
+                        return refresh(stale);
+                    }
+                    return entry->snapshot;
+                }
+            }
+            sweep(cache);
+            cache.emplace_back(new CachedSnapshot(this->state));
+            return refresh(*cache.back());
+        }
+
+        //a counted copy of the current snapshot straight from the publisher, bypassing the thread's cache
+        SharedPtr<T> load() const {
+            return this->state->current.load();
+        }
+
+        //number of publishes so far, plus one
+        std::uint64_t version() const {
+            return this->state->version.load(std::memory_order_acquire);
+        }
+};
+
+#endif // SNAPSHOT_PUBLISHER_H
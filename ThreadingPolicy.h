@@ -0,0 +1,133 @@
+#ifndef THREADING_POLICY_H
+#define THREADING_POLICY_H
+
+#include "RefCountStats.h"
+#include <atomic>
+#include <cassert>
+#include <thread>
+
+/* Thread ownership checks of SingleThreaded counts and use-after-release checks of Borrowed views. They change the
+* layout of counts and what views hold, so every translation unit of a program has to agree on the setting: switch
+* them on project-wide with -DSHAREDPTR_DEBUG_CHECKS=1, never per file. NDEBUG only silences the asserts, it leaves
+* the layout alone, since a program may well mix translation units built with and without it.
+*/
+#ifndef SHAREDPTR_DEBUG_CHECKS
+#define SHAREDPTR_DEBUG_CHECKS 0
+#endif
+
+/* Threading policies pick how a control block counts its owners, selected per pointer type as the second template
+* argument of SharedPtr, WeakPtr and MakeShared. A policy provides a Count type for owners and a WeakCount type for
+* observers, both with:
+*   increment()          add a reference on behalf of a caller that already holds one
+*   incrementIfNonZero() add a reference only if the count has not dropped to zero, used by WeakPtr::lock()
+*   decrement()          drop a reference, true if it was the last one
+*   load()               current value, for getCount() and use_count()
+*   isOnly()             true if the count is exactly one and nobody else can change it, lets the last release skip an
+*                        RMW, only needed on WeakCount
+*   decrementBy(n)       drop n references at once, true if they were the last ones, only needed by policies that
+*                        batch releases (see ReleaseBatching.h)
+*/
+
+//default policy, counts are atomic and handles sharing an object may live on different threads, like std::shared_ptr
+struct MultiThreaded {
+    class Count {
+        private:
+            std::atomic<unsigned int> value;
+        public:
+            explicit Count(unsigned int value) : value(value) {}
+
+            //relaxed is enough, the caller's own reference keeps the object alive and nothing is published
+            void increment() {
+                this->value.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            //CAS loop so an object whose last owner already started destroying it is never resurrected
+            bool incrementIfNonZero() {
+                unsigned int current = this->value.load(std::memory_order_relaxed);
+                while (current != 0) {
+                    if (this->value.compare_exchange_weak(current, current + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        return true;
+                    }
+                    detail::noteCasRetry();
+                }
+                return false;
+            }
+
+            //releases our writes to the object, and the last owner acquires everyone else's before destroying it
+            bool decrement() {
+                return this->value.fetch_sub(1, std::memory_order_acq_rel) == 1;
+            }
+
+            bool decrementBy(unsigned int n) {
+                return this->value.fetch_sub(n, std::memory_order_acq_rel) == n;
+            }
+
+            unsigned int load() const {
+                return this->value.load(std::memory_order_acquire);
+            }
+
+            bool isOnly() const {
+                return this->value.load(std::memory_order_acquire) == 1;
+            }
+    };
+    typedef Count WeakCount;
+};
+
+/* For object graphs owned by one thread: counts are plain integers, so copies and releases compile down to ordinary
+* increments and decrements with no atomic RMW and no fences. Every handle and observer of an object must stay on the
+* thread that created it. With SHAREDPTR_DEBUG_CHECKS each count records that thread and asserts on any use from
+* another one.
+*/
+struct SingleThreaded {
+    class Count {
+        private:
+            unsigned int value;
+#if SHAREDPTR_DEBUG_CHECKS
+            std::thread::id owner;
+
+            void checkOwner() const {
+                assert(this->owner == std::this_thread::get_id() && "SingleThreaded SharedPtr used from a thread other than its owner");
+            }
+#else
+            void checkOwner() const {}
+#endif
+        public:
+            explicit Count(unsigned int value) : value(value) {
+#if SHAREDPTR_DEBUG_CHECKS
+                this->owner = std::this_thread::get_id();
+#endif
+            }
+
+            void increment() {
+                checkOwner();
+                ++this->value;
+            }
+
+            bool incrementIfNonZero() {
+                checkOwner();
+                if (this->value == 0) {
+                    return false;
+                }
+                ++this->value;
+                return true;
+            }
+
+            bool decrement() {
+                checkOwner();
+                return --this->value == 0;
+            }
+
+            unsigned int load() const {
+                checkOwner();
+                return this->value;
+            }
+
+            bool isOnly() const {
+                checkOwner();
+                return this->value == 1;
+            }
+    };
+    typedef Count WeakCount;
+};
+
+#endif // THREADING_POLICY_H
@@ -0,0 +1,978 @@
+#include "SharedPtr.h"
+#include "AtomicSharedPtr.h"
+#include "ShardedPolicy.h"
+#include "BiasedPolicy.h"
+#include "RefCounted.h"
+#include "Borrowed.h"
+#include "SharedPtrQueue.h"
+#include "SharedCache.h"
+#include "SnapshotPublisher.h"
+#include "RecyclingPool.h"
+#include "GraphSerializer.h"
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/* Benchmarks time the same workloads the correctness tests in main.cpp run, so SharedPtr changes can be
+* compared before/after and against std::shared_ptr on identical work.
+* The following workloads are covered:
+* 1. Stress (100k objects: create, read, copy, move), with pointer adoption and with MakeShared
+* 2. Concurrent copy and assignment (10 threads x 1000 iterations)
+* 3. Large number of threads (1000 threads x 1000 copies of one pointer)
+* 4. Hot-swapped slot (N readers loading while one writer stores), AtomicSharedPtr vs std::mutex + SharedPtr
+* 5. Control block churn (threads creating and dropping SharedPtr(new T)), pooled blocks vs new/delete
+* 6. Copy/destroy loop on one thread, MultiThreaded vs SingleThreaded policy
+* 7. Hot singleton copied by 1 to N threads, MultiThreaded vs Sharded policy
+* 8. Owner-only, mixed and fully shared copies, MultiThreaded vs Biased policy
+* 9. Releasing thread latency for large object graphs, inline destruction vs the background reclaimer
+* 10. Building, walking and dropping a tree of small nodes, intrusive counts vs control blocks
+* 11. Request handlers passing a shared object down a chain of helpers, SharedPtr by value vs Borrowed
+* 12. Tearing down 100k handles spread over 10, 1k or 100k objects, immediate vs batched releases
+* 13. Handing work items from 1 to 32 producers to as many consumers, SharedPtrQueue vs std::mutex + std::deque
+* 14. Skewed lookups from 1 to 8 threads, SharedCache vs an unbounded std::unordered_map behind one std::mutex
+* 15. Reading a published snapshot from 1 to 64 threads while a writer republishes it, SnapshotPublisher vs copying
+*     a global handle (std::mutex + SharedPtr and AtomicSharedPtr)
+* 16. Acquiring, filling and dropping 64 KiB frames from 1 to 8 threads, RecyclingPool vs MakeShared
+* 17. Saving and reloading a graph of 1.1M nodes where every leaf has ten parents, GraphWriter and a memory mapped
+*     GraphReader vs writing every reference out in full
+* 18. Handing a SharedPtr to a library speaking std::shared_ptr and taking its result back, toStd()/fromStd() vs
+*     wrapping each side in a deleter that holds the other
+*/
+
+class BenchObject {
+public:
+    int value;
+    BenchObject(int val) : value(val) {}
+};
+
+//same as BenchObject, but its control blocks come from the per-thread pool
+class PooledBenchObject : public BenchObject {
+public:
+    PooledBenchObject(int val) : BenchObject(val) {}
+};
+
+template <>
+struct PooledControlBlocks<PooledBenchObject> : std::true_type {};
+
+//an object graph with many separately allocated nodes, expensive to free
+class BenchGraph {
+public:
+    std::vector<std::unique_ptr<BenchObject>> nodes;
+    BenchGraph(int size) {
+        for (int i = 0; i < size; ++i) {
+            nodes.emplace_back(new BenchObject(i));
+        }
+    }
+};
+
+//same as BenchGraph, but destroyed by the Reclaimer
+class DeferredBenchGraph : public BenchGraph {
+public:
+    DeferredBenchGraph(int size) : BenchGraph(size) {}
+};
+
+template <>
+struct DeferredDestruction<DeferredBenchGraph> : std::true_type {};
+
+//same as BenchObject, but released in batches inside a ScopedReleaseBatching
+class BatchedBenchObject : public BenchObject {
+public:
+    BatchedBenchObject(int val) : BenchObject(val) {}
+};
+
+template <>
+struct BatchedReleases<BatchedBenchObject> : std::true_type {};
+
+//a message frame with a large buffer, what RecyclingPool is meant to keep around
+class BenchFrame {
+public:
+    std::vector<char> payload;
+    BenchFrame() : payload(64 * 1024) {}
+};
+
+//node of the graphs saved and loaded by the restart workload
+class BenchGraphNode {
+public:
+    std::int64_t value;
+    SharedPtr<BenchGraphNode> left, right;
+    BenchGraphNode(std::int64_t val) : value(val) {}
+};
+
+template <>
+struct GraphCodec<BenchGraphNode> {
+    template <typename Visit>
+    static void forEachChild(const BenchGraphNode& node, Visit&& visit) {
+        visit(node.left);
+        visit(node.right);
+    }
+    static void save(const BenchGraphNode& node, GraphWriter<BenchGraphNode>& out) {
+        out.writeVarint(static_cast<std::uint64_t>(node.value));
+        out.writeChild(node.left);
+        out.writeChild(node.right);
+    }
+    static SharedPtr<BenchGraphNode> load(GraphReader<BenchGraphNode>& in) {
+        SharedPtr<BenchGraphNode> node = MakeShared<BenchGraphNode>(static_cast<std::int64_t>(in.readVarint()));
+        node->left = in.readChild();
+        node->right = in.readChild();
+        return node;
+    }
+};
+
+//small tree nodes, counted in a control block or in the node itself
+class BlockNode {
+public:
+    int value;
+    SharedPtr<BlockNode> left, right;
+    BlockNode(int val) : value(val) {}
+};
+
+class IntrusiveBenchNode : public RefCounted<IntrusiveBenchNode> {
+public:
+    int value;
+    SharedPtr<IntrusiveBenchNode, Intrusive<>> left, right;
+    IntrusiveBenchNode(int val) : value(val) {}
+};
+
+//run a workload a few times and report the best wall clock time in milliseconds
+template <typename F>
+double bestOf(int runs, F&& workload) {
+    double best = 0;
+    for (int i = 0; i < runs; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        workload();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (i == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+    return best;
+}
+
+template <typename Ptr, typename Make>
+void stressWorkload(Make make) {
+    const int numObjects = 100000;
+    std::vector<Ptr> spArray(numObjects);
+    for (int i = 0; i < numObjects; ++i) {
+        spArray[i] = make(i);
+    }
+    long sum = 0;
+    for (int i = 0; i < numObjects; ++i) {
+        sum += spArray[i].get()->value;
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        Ptr spCopy = spArray[i];
+        sum += spCopy.get()->value;
+    }
+    for (int i = 0; i < numObjects; ++i) {
+        Ptr spMove = std::move(spArray[i]);
+        sum += spMove.get()->value;
+    }
+    if (sum == 0) {
+        std::cout << "";
+    }
+}
+
+template <typename Ptr>
+void concurrentCopyAndAssignmentWorkload(const Ptr& sp1) {
+    const int numThreads = 10;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&sp1]() {
+            for (int j = 0; j < 1000; ++j) {
+                Ptr sp2(sp1);
+                Ptr sp3;
+                sp3 = sp1;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+template <typename Ptr>
+void largeNumberOfThreadsWorkload(const Ptr& sp) {
+    const int numThreads = 1000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&sp]() {
+            for (int j = 0; j < 1000; ++j) {
+                Ptr spCopy(sp);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+//the baseline AtomicSharedPtr replaces, a SharedPtr guarded by one mutex
+template <typename T>
+class MutexSlot {
+    private:
+        mutable std::mutex mtx;
+        SharedPtr<T> value;
+    public:
+        explicit MutexSlot(SharedPtr<T> value) : value(std::move(value)) {}
+        SharedPtr<T> load() const {
+            std::lock_guard<std::mutex> guard(mtx);
+            return value;
+        }
+        void store(SharedPtr<T> desired) {
+            std::lock_guard<std::mutex> guard(mtx);
+            value = std::move(desired);
+        }
+};
+
+//readers load the slot in a loop while one writer stores a new value every 100 microseconds, returns loads per millisecond
+template <typename Slot>
+double hotSwapWorkload(int numReaders) {
+    Slot slot(MakeShared<BenchObject>(0));
+    std::atomic<bool> done(false);
+    std::atomic<long> loads(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numReaders; ++i) {
+        threads.emplace_back([&]() {
+            long local = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                SharedPtr<BenchObject> sp = slot.load();
+                local += sp->value >= 0;
+            }
+            loads += local;
+        });
+    }
+    threads.emplace_back([&]() {
+        for (int j = 1; !done.load(std::memory_order_relaxed); ++j) {
+            slot.store(MakeShared<BenchObject>(j));
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    const int durationMs = 200;
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return static_cast<double>(loads.load()) / durationMs;
+}
+
+//how readers and the writer get at each kind of slot, SnapshotPublisher hands out its cached handle instead of a copy
+int readSnapshot(const SnapshotPublisher<BenchObject>& publisher) {
+    return publisher.read()->value;
+}
+template <typename Slot>
+int readSnapshot(const Slot& slot) {
+    return slot.load()->value;
+}
+void publishSnapshot(SnapshotPublisher<BenchObject>& publisher, SharedPtr<BenchObject> snapshot) {
+    publisher.publish(std::move(snapshot));
+}
+template <typename Slot>
+void publishSnapshot(Slot& slot, SharedPtr<BenchObject> snapshot) {
+    slot.store(std::move(snapshot));
+}
+
+//readers read the current snapshot in a loop while one writer publishes a new one every 10 milliseconds, returns reads per millisecond
+template <typename Slot>
+double snapshotReadWorkload(int numReaders) {
+    Slot slot(MakeShared<BenchObject>(0));
+    std::atomic<bool> done(false);
+    std::atomic<long> reads(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numReaders; ++i) {
+        threads.emplace_back([&]() {
+            long local = 0;
+            long sum = 0;
+            while (!done.load(std::memory_order_relaxed)) {
+                sum += readSnapshot(slot);
+                ++local;
+            }
+            if (sum < 0) {
+                std::cout << "";
+            }
+            reads += local;
+        });
+    }
+    threads.emplace_back([&]() {
+        for (int j = 1; !done.load(std::memory_order_relaxed); ++j) {
+            publishSnapshot(slot, MakeShared<BenchObject>(j));
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+    const int durationMs = 200;
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return static_cast<double>(reads.load()) / durationMs;
+}
+
+//copy and drop one handle in a tight loop, returns copies per millisecond
+template <typename Policy>
+double copyDestroyWorkload() {
+    const long iterations = 20000000;
+    SharedPtr<BenchObject, Policy> sp = MakeShared<BenchObject, Policy>(1);
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        SharedPtr<BenchObject, Policy> spCopy(sp);
+        sum += spCopy->value;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum != iterations) {
+        std::cout << "";
+    }
+    return iterations / elapsed.count();
+}
+
+//every thread copies and drops the same long-lived handle, returns total copies per millisecond
+template <typename Policy>
+double hotSingletonWorkload(int numThreads) {
+    const long copiesPerThread = 2000000;
+    SharedPtr<BenchObject, Policy> singleton = MakeShared<BenchObject, Policy>(1);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&singleton]() {
+            long sum = 0;
+            for (long j = 0; j < copiesPerThread; ++j) {
+                SharedPtr<BenchObject, Policy> spCopy(singleton);
+                sum += spCopy->value;
+            }
+            if (sum != copiesPerThread) {
+                std::cout << "";
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return numThreads * copiesPerThread / elapsed.count();
+}
+
+//the creating thread copies in a tight loop while one other thread copies the same object a sixteenth as often, returns total copies per millisecond
+template <typename Policy>
+double mixedOwnershipWorkload() {
+    const long ownerCopies = 20000000;
+    SharedPtr<BenchObject, Policy> sp = MakeShared<BenchObject, Policy>(1);
+    auto start = std::chrono::steady_clock::now();
+    std::thread other([&sp]() {
+        SharedPtr<BenchObject, Policy> escaped(sp);
+        long sum = 0;
+        for (long j = 0; j < ownerCopies / 16; ++j) {
+            SharedPtr<BenchObject, Policy> spCopy(escaped);
+            sum += spCopy->value;
+        }
+        if (sum == 0) {
+            std::cout << "";
+        }
+    });
+    long sum = 0;
+    for (long i = 0; i < ownerCopies; ++i) {
+        SharedPtr<BenchObject, Policy> spCopy(sp);
+        sum += spCopy->value;
+    }
+    other.join();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum == 0) {
+        std::cout << "";
+    }
+    return (ownerCopies + ownerCopies / 16) / elapsed.count();
+}
+
+//complete binary tree of the given depth, every node made with MakeShared
+template <typename Node, typename Policy>
+SharedPtr<Node, Policy> buildTree(int depth, int& next) {
+    SharedPtr<Node, Policy> node = MakeShared<Node, Policy>(next++);
+    if (depth > 1) {
+        node->left = buildTree<Node, Policy>(depth - 1, next);
+        node->right = buildTree<Node, Policy>(depth - 1, next);
+    }
+    return node;
+}
+
+//copies every handle on the way down, like a visitor that keeps the node it is working on alive
+template <typename Node, typename Policy>
+long walkTree(SharedPtr<Node, Policy> node) {
+    if (node.get() == nullptr) {
+        return 0;
+    }
+    return node->value + walkTree<Node, Policy>(node->left) + walkTree<Node, Policy>(node->right);
+}
+
+//build a tree of 2^20 nodes, walk it four times and drop it
+template <typename Node, typename Policy>
+void treeWorkload() {
+    int next = 0;
+    SharedPtr<Node, Policy> root = buildTree<Node, Policy>(20, next);
+    long sum = 0;
+    for (int i = 0; i < 4; ++i) {
+        sum += walkTree<Node, Policy>(root);
+    }
+    if (sum == 0) {
+        std::cout << "";
+    }
+}
+
+#if defined(_MSC_VER)
+#define BENCH_NOINLINE __declspec(noinline)
+#else
+#define BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+//one level of a request handler's call chain, kept out of line so every level really passes the handle
+template <typename Handle>
+BENCH_NOINLINE long handleRequest(Handle object, int depth) {
+    //a compiler barrier, so the chain is not folded into one computation hoisted out of the request loop
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (depth == 0) {
+        return object->value;
+    }
+    return object->value + handleRequest<Handle>(object, depth - 1);
+}
+
+//threads run requests that pass one shared object through 12 helpers each, returns requests per millisecond
+template <typename Handle>
+double callChainWorkload(int numThreads) {
+    const long requestsPerThread = 500000;
+    SharedPtr<BenchObject> shared = MakeShared<BenchObject>(1);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&shared]() {
+            long sum = 0;
+            for (long j = 0; j < requestsPerThread; ++j) {
+                sum += handleRequest<Handle>(shared, 12);
+            }
+            if (sum == 0) {
+                std::cout << "";
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return numThreads * requestsPerThread / elapsed.count();
+}
+
+//clear a vector of 100k handles to numObjects objects, each held by the objects themselves too, returns handles released per millisecond
+template <typename T>
+double teardownWorkload(int numObjects) {
+    const int numHandles = 100000;
+    const int rounds = 20;
+    std::vector<SharedPtr<T>> objects;
+    for (int i = 0; i < numObjects; ++i) {
+        objects.push_back(MakeShared<T>(i));
+    }
+    double totalMs = 0;
+    for (int round = 0; round < rounds; ++round) {
+        std::vector<SharedPtr<T>> handles;
+        handles.reserve(numHandles);
+        for (int i = 0; i < numHandles; ++i) {
+            handles.push_back(objects[i % numObjects]);
+        }
+        auto start = std::chrono::steady_clock::now();
+        {
+            ScopedReleaseBatching batching;
+            handles.clear();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        totalMs += elapsed.count();
+    }
+    return rounds * numHandles / totalMs;
+}
+
+//the baseline SharedPtrQueue replaces, a std::deque of handles guarded by one mutex
+template <typename T>
+class MutexQueue {
+    private:
+        std::mutex mtx;
+        std::deque<SharedPtr<T>> items;
+    public:
+        bool push(SharedPtr<T>&& item) {
+            std::lock_guard<std::mutex> guard(mtx);
+            items.push_back(std::move(item));
+            return true;
+        }
+        bool pop(SharedPtr<T>& out) {
+            std::lock_guard<std::mutex> guard(mtx);
+            if (items.empty()) {
+                return false;
+            }
+            out = std::move(items.front());
+            items.pop_front();
+            return true;
+        }
+};
+
+//numThreads producers each push their share of 200k items while as many consumers pop them, returns items per millisecond
+template <typename Queue>
+double workQueueWorkload(Queue& queue, int numThreads) {
+    const int numItems = 200000;
+    const int perProducer = numItems / numThreads;
+    std::vector<SharedPtr<BenchObject>> work;
+    for (int i = 0; i < perProducer * numThreads; ++i) {
+        work.push_back(MakeShared<BenchObject>(i));
+    }
+    std::atomic<int> remaining(perProducer * numThreads);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&queue, &work, i, perProducer]() {
+            for (int j = i * perProducer; j < (i + 1) * perProducer; ++j) {
+                while (!queue.push(std::move(work[j]))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&queue, &remaining]() {
+            SharedPtr<BenchObject> item;
+            long sum = 0;
+            while (remaining.load(std::memory_order_relaxed) > 0) {
+                if (queue.pop(item)) {
+                    sum += item->value;
+                    remaining.fetch_sub(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            if (sum < 0) {
+                std::cout << "";
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return perProducer * numThreads / elapsed.count();
+}
+
+//the baseline SharedCache replaces, one map behind one mutex that never evicts
+template <typename K, typename T>
+class MutexCache {
+    private:
+        std::mutex mtx;
+        std::unordered_map<K, SharedPtr<T>> values;
+    public:
+        template <typename Factory>
+        SharedPtr<T> getOrCreate(const K& key, Factory&& factory) {
+            std::lock_guard<std::mutex> guard(mtx);
+            SharedPtr<T>& value = values[key];
+            if (value.get() == nullptr) {
+                value = factory();
+            }
+            return value;
+        }
+};
+
+//threads look up 200k keys each from 10k, skewed towards low keys, returns lookups per millisecond
+template <typename Cache>
+double cacheWorkload(Cache& cache, int numThreads) {
+    const int lookupsPerThread = 200000;
+    const int numKeys = 10000;
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&cache, i]() {
+            std::minstd_rand random(i + 1);
+            long sum = 0;
+            for (int j = 0; j < lookupsPerThread; ++j) {
+                //the square of a uniform draw, so key k is hit about as often as 1 / sqrt(k)
+                long draw = random() % numKeys;
+                int key = static_cast<int>(draw * draw / numKeys);
+                sum += cache.getOrCreate(key, [key]() { return MakeShared<BenchObject>(key); })->value;
+            }
+            if (sum < 0) {
+                std::cout << "";
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return numThreads * lookupsPerThread / elapsed.count();
+}
+
+//threads each take a frame, write its header and drop it again, returns frames per millisecond
+template <typename Source>
+double frameChurnWorkload(Source& source, int numThreads) {
+    const int framesPerThread = 50000;
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&source, i]() {
+            long sum = 0;
+            for (int j = 0; j < framesPerThread; ++j) {
+                SharedPtr<BenchFrame> frame = source.acquire();
+                frame->payload[0] = static_cast<char>(i + j);
+                sum += frame->payload[0];
+            }
+            if (sum == 1) {
+                std::cout << "";
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return numThreads * framesPerThread / elapsed.count();
+}
+
+//the baseline RecyclingPool replaces, a fresh frame from MakeShared every time
+struct FreshFrames {
+    SharedPtr<BenchFrame> acquire() {
+        return MakeShared<BenchFrame>();
+    }
+};
+
+//numParents roots, each pointing at two of numShared leaves picked at random
+std::vector<SharedPtr<BenchGraphNode>> buildSharedGraph(int numParents, int numShared) {
+    std::vector<SharedPtr<BenchGraphNode>> leaves;
+    for (int i = 0; i < numShared; ++i) {
+        leaves.push_back(MakeShared<BenchGraphNode>(i));
+    }
+    std::minstd_rand random(1);
+    std::vector<SharedPtr<BenchGraphNode>> roots;
+    for (int i = 0; i < numParents; ++i) {
+        SharedPtr<BenchGraphNode> parent = MakeShared<BenchGraphNode>(numShared + i);
+        parent->left = leaves[random() % numShared];
+        parent->right = leaves[random() % numShared];
+        roots.push_back(std::move(parent));
+    }
+    return roots;
+}
+
+//the baseline, a serializer that does not know which nodes it has seen writes every reference out in full
+void writeTree(std::ofstream& out, const BenchGraphNode* node) {
+    char present = node != nullptr;
+    out.write(&present, 1);
+    if (node != nullptr) {
+        out.write(reinterpret_cast<const char*>(&node->value), sizeof(node->value));
+        writeTree(out, node->left.get());
+        writeTree(out, node->right.get());
+    }
+}
+
+//and builds a separate copy for every reference when loading
+SharedPtr<BenchGraphNode> readTree(const char*& pos) {
+    if (*pos++ == 0) {
+        return SharedPtr<BenchGraphNode>();
+    }
+    std::int64_t value;
+    std::memcpy(&value, pos, sizeof(value));
+    pos += sizeof(value);
+    SharedPtr<BenchGraphNode> node = MakeShared<BenchGraphNode>(value);
+    node->left = readTree(pos);
+    node->right = readTree(pos);
+    return node;
+}
+
+//resident set size of the process in MiB, 0 where /proc/self/statm does not exist
+double residentMb() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t total = 0, resident = 0;
+    if (!(statm >> total >> resident)) {
+        return 0;
+    }
+    return resident * 4096.0 / (1024 * 1024);
+}
+
+struct RestartResult {
+    double saveMs;
+    double fileMb;
+    double loadMs;
+    //growth of the resident set while loading, the loaded graph itself
+    double loadedMb;
+};
+
+//save roots to a file, then time loading it back from a memory mapping as a restarting process would
+template <bool KeepSharing>
+RestartResult restartWorkload(const std::vector<SharedPtr<BenchGraphNode>>& roots) {
+    const char* path = "benchmark.graph";
+    RestartResult result;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::ofstream out(path, std::ios::binary);
+        if (KeepSharing) {
+            saveGraph(out, roots);
+        } else {
+            for (const SharedPtr<BenchGraphNode>& root : roots) {
+                writeTree(out, root.get());
+            }
+        }
+    }
+    result.saveMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    double residentBefore = residentMb();
+    start = std::chrono::steady_clock::now();
+    std::vector<SharedPtr<BenchGraphNode>> loaded;
+    {
+        MappedFile file(path);
+        result.fileMb = file.size() / (1024.0 * 1024.0);
+        if (KeepSharing) {
+            loaded = loadGraph<BenchGraphNode>(file.data(), file.size());
+        } else {
+            const char* pos = file.data();
+            for (std::size_t i = 0; i < roots.size(); ++i) {
+                loaded.push_back(readTree(pos));
+            }
+        }
+    }
+    result.loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    result.loadedMb = residentMb() - residentBefore;
+    std::remove(path);
+    return result;
+}
+
+//stands in for a third party function speaking std::shared_ptr, it hands back what it was given
+template <typename T>
+std::shared_ptr<T> passThrough(std::shared_ptr<T> object) {
+    return object;
+}
+
+//crossing the boundary with the conversions SharedPtr provides, a round trip hands the original handle back
+struct InteropCrossing {
+    template <typename T>
+    static std::shared_ptr<T> toStd(const SharedPtr<T>& object) {
+        return object.toStd();
+    }
+    template <typename T>
+    static SharedPtr<T> fromStd(std::shared_ptr<T> object) {
+        return SharedPtr<T>::fromStd(std::move(object));
+    }
+};
+
+//the baseline, each conversion allocates a block whose deleter keeps the other side's handle alive
+struct WrappingCrossing {
+    template <typename T>
+    static std::shared_ptr<T> toStd(const SharedPtr<T>& object) {
+        return std::shared_ptr<T>(object.get(), [keep = object](T*) {});
+    }
+    template <typename T>
+    static SharedPtr<T> fromStd(std::shared_ptr<T> object) {
+        T* ptr = object.get();
+        return SharedPtr<T>(ptr, [keep = std::move(object)](T*) {});
+    }
+};
+
+//convert a long-lived handle to std::shared_ptr, pass it through the library and convert the result back, returns round trips per millisecond
+template <typename Crossing, typename T>
+double boundaryWorkload() {
+    const long iterations = 2000000;
+    SharedPtr<T> core = MakeShared<T>(1);
+    long sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        SharedPtr<T> back = Crossing::fromStd(passThrough(Crossing::toStd(core)));
+        sum += back->value;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    if (sum != iterations) {
+        std::cout << "";
+    }
+    return iterations / elapsed.count();
+}
+
+struct LatencyResult {
+    double p50Ns;
+    double p99Ns;
+};
+
+//time only the final release of freshly built graphs, the part a request thread would see, flushing the reclaimer
+//between requests if asked to
+template <typename Graph>
+LatencyResult releaseLatencyWorkload(bool flushBetween) {
+    const int releases = 500;
+    std::vector<float> latencies(releases);
+    for (int i = 0; i < releases; ++i) {
+        SharedPtr<Graph> graph = MakeShared<Graph>(10000);
+        auto start = std::chrono::steady_clock::now();
+        graph.reset();
+        latencies[i] = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count();
+        if (flushBetween) {
+            Reclaimer::instance().flush();
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    return LatencyResult{latencies[releases / 2], latencies[releases * 99 / 100]};
+}
+
+struct ChurnResult {
+    double opsPerMs;
+    double p99Ns;
+};
+
+//threads each create and drop a SharedPtr(new T) in a loop, timing every create+drop pair for the latency percentile
+template <typename T>
+ChurnResult churnWorkload(int numThreads) {
+    const int opsPerThread = 200000;
+    std::vector<std::vector<float>> latencies(numThreads, std::vector<float>(opsPerThread));
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&latencies, i]() {
+            for (int j = 0; j < opsPerThread; ++j) {
+                auto opStart = std::chrono::steady_clock::now();
+                {
+                    SharedPtr<T> sp(new T(j));
+                    SharedPtr<T> spCopy(sp);
+                }
+                latencies[i][j] = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - opStart).count();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::vector<float> all;
+    for (auto& perThread : latencies) {
+        all.insert(all.end(), perThread.begin(), perThread.end());
+    }
+    std::nth_element(all.begin(), all.begin() + all.size() * 99 / 100, all.end());
+    return ChurnResult{numThreads * opsPerThread / elapsed.count(), all[all.size() * 99 / 100]};
+}
+
+void report(const char* name, double custom, double standard) {
+    std::cout << name << ": SharedPtr " << custom << " ms, std::shared_ptr " << standard << " ms" << std::endl;
+}
+
+int main() {
+    const int runs = 5;
+    std::cout << "sizeof(SharedPtr<BenchObject>) = " << sizeof(SharedPtr<BenchObject>)
+              << ", sizeof(std::shared_ptr<BenchObject>) = " << sizeof(std::shared_ptr<BenchObject>) << std::endl;
+
+    report("stress",
+        bestOf(runs, [] { stressWorkload<SharedPtr<BenchObject>>([](int i) { return SharedPtr<BenchObject>(new BenchObject(i)); }); }),
+        bestOf(runs, [] { stressWorkload<std::shared_ptr<BenchObject>>([](int i) { return std::shared_ptr<BenchObject>(new BenchObject(i)); }); }));
+
+    report("stressMakeShared",
+        bestOf(runs, [] { stressWorkload<SharedPtr<BenchObject>>([](int i) { return MakeShared<BenchObject>(i); }); }),
+        bestOf(runs, [] { stressWorkload<std::shared_ptr<BenchObject>>([](int i) { return std::make_shared<BenchObject>(i); }); }));
+
+    SharedPtr<BenchObject> shared(new BenchObject(190));
+    std::shared_ptr<BenchObject> stdShared(new BenchObject(190));
+    report("concurrentCopyAndAssignment",
+        bestOf(runs, [&] { concurrentCopyAndAssignmentWorkload(shared); }),
+        bestOf(runs, [&] { concurrentCopyAndAssignmentWorkload(stdShared); }));
+    report("largeNumberOfThreads",
+        bestOf(runs, [&] { largeNumberOfThreadsWorkload(shared); }),
+        bestOf(runs, [&] { largeNumberOfThreadsWorkload(stdShared); }));
+
+    for (int readers = 1; readers <= 8; readers *= 2) {
+        std::cout << "hotSwap " << readers << " readers: AtomicSharedPtr " << hotSwapWorkload<AtomicSharedPtr<BenchObject>>(readers)
+                  << " loads/ms, std::mutex + SharedPtr " << hotSwapWorkload<MutexSlot<BenchObject>>(readers) << " loads/ms" << std::endl;
+    }
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        ChurnResult plain = churnWorkload<BenchObject>(threads);
+        ChurnResult pooled = churnWorkload<PooledBenchObject>(threads);
+        std::cout << "churn " << threads << " threads: pooled " << pooled.opsPerMs << " ops/ms p99 " << pooled.p99Ns
+                  << " ns, new/delete " << plain.opsPerMs << " ops/ms p99 " << plain.p99Ns << " ns" << std::endl;
+    }
+
+    std::cout << "copyDestroy: MultiThreaded " << copyDestroyWorkload<MultiThreaded>() << " copies/ms, SingleThreaded "
+              << copyDestroyWorkload<SingleThreaded>() << " copies/ms" << std::endl;
+
+    unsigned int maxThreads = std::max(8u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= maxThreads; threads *= 2) {
+        std::cout << "hotSingleton " << threads << " threads: MultiThreaded " << hotSingletonWorkload<MultiThreaded>(threads)
+                  << " copies/ms, Sharded " << hotSingletonWorkload<Sharded<>>(threads) << " copies/ms" << std::endl;
+    }
+
+    //hotSingleton creates the object on the main thread, so with Biased every copy comes from a non-owner thread
+    std::cout << "ownerOnly: MultiThreaded " << copyDestroyWorkload<MultiThreaded>() << " copies/ms, Biased "
+              << copyDestroyWorkload<Biased>() << " copies/ms" << std::endl;
+    std::cout << "mixedOwnership: MultiThreaded " << mixedOwnershipWorkload<MultiThreaded>() << " copies/ms, Biased "
+              << mixedOwnershipWorkload<Biased>() << " copies/ms" << std::endl;
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        std::cout << "fullyShared " << threads << " threads: MultiThreaded " << hotSingletonWorkload<MultiThreaded>(threads)
+                  << " copies/ms, Biased " << hotSingletonWorkload<Biased>(threads) << " copies/ms" << std::endl;
+    }
+
+    LatencyResult inlineRelease = releaseLatencyWorkload<BenchGraph>(false);
+    LatencyResult flushedRelease = releaseLatencyWorkload<DeferredBenchGraph>(true);
+    Reclaimer::instance().startThread();
+    LatencyResult threadRelease = releaseLatencyWorkload<DeferredBenchGraph>(false);
+    Reclaimer::instance().stopThread();
+    std::cout << "releaseLatency: inline p50 " << inlineRelease.p50Ns << " ns p99 " << inlineRelease.p99Ns
+              << " ns, flush() between requests p50 " << flushedRelease.p50Ns << " ns p99 " << flushedRelease.p99Ns
+              << " ns, reclaimer thread p50 " << threadRelease.p50Ns << " ns p99 " << threadRelease.p99Ns << " ns" << std::endl;
+
+    std::cout << "tree: intrusive " << bestOf(runs, [] { treeWorkload<IntrusiveBenchNode, Intrusive<>>(); })
+              << " ms, control block " << bestOf(runs, [] { treeWorkload<BlockNode, MultiThreaded>(); }) << " ms" << std::endl;
+
+    for (int threads = 1; threads <= 4; threads *= 2) {
+        std::cout << "callChain " << threads << " threads: SharedPtr by value " << callChainWorkload<SharedPtr<BenchObject>>(threads)
+                  << " requests/ms, Borrowed " << callChainWorkload<Borrowed<BenchObject>>(threads) << " requests/ms" << std::endl;
+    }
+
+    for (int objects = 10; objects <= 100000; objects *= 100) {
+        std::cout << "teardown " << objects << " objects: immediate " << teardownWorkload<BenchObject>(objects)
+                  << " releases/ms, batched " << teardownWorkload<BatchedBenchObject>(objects) << " releases/ms" << std::endl;
+    }
+
+    for (int threads = 1; threads <= 32; threads *= 2) {
+        SharedPtrQueue<BenchObject> lockFree(1024);
+        MutexQueue<BenchObject> locked;
+        std::cout << "workQueue " << threads << " producers/consumers: SharedPtrQueue " << workQueueWorkload(lockFree, threads)
+                  << " items/ms, std::mutex + std::deque " << workQueueWorkload(locked, threads) << " items/ms" << std::endl;
+    }
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        SharedCache<int, BenchObject> everything(20000);
+        SharedCache<int, BenchObject> bounded(2000);
+        MutexCache<int, BenchObject> locked;
+        double everythingRate = cacheWorkload(everything, threads);
+        double boundedRate = cacheWorkload(bounded, threads);
+        SharedCache<int, BenchObject>::Stats stats = bounded.stats();
+        std::cout << "cache " << threads << " threads: SharedCache with room for every key " << everythingRate << " lookups/ms, for 2k keys "
+                  << boundedRate << " lookups/ms at " << 100.0 * stats.hits / (stats.hits + stats.misses)
+                  << "% hits, std::mutex + std::unordered_map " << cacheWorkload(locked, threads) << " lookups/ms" << std::endl;
+    }
+
+    for (int readers = 1; readers <= 64; readers *= 2) {
+        std::cout << "snapshot " << readers << " readers: SnapshotPublisher " << snapshotReadWorkload<SnapshotPublisher<BenchObject>>(readers)
+                  << " reads/ms, std::mutex + SharedPtr " << snapshotReadWorkload<MutexSlot<BenchObject>>(readers)
+                  << " reads/ms, AtomicSharedPtr " << snapshotReadWorkload<AtomicSharedPtr<BenchObject>>(readers) << " reads/ms" << std::endl;
+    }
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        RecyclingPool<BenchFrame> pool(64);
+        FreshFrames fresh;
+        std::cout << "frames " << threads << " threads: RecyclingPool " << frameChurnWorkload(pool, threads)
+                  << " frames/ms, MakeShared " << frameChurnWorkload(fresh, threads) << " frames/ms" << std::endl;
+    }
+
+    {
+        std::vector<SharedPtr<BenchGraphNode>> graph = buildSharedGraph(1000000, 100000);
+        RestartResult shared = restartWorkload<true>(graph);
+        RestartResult copied = restartWorkload<false>(graph);
+        std::cout << "restart 1.1M nodes: GraphWriter save " << shared.saveMs << " ms, " << shared.fileMb << " MiB, load " << shared.loadMs
+                  << " ms, +" << shared.loadedMb << " MiB resident; full references save " << copied.saveMs << " ms, " << copied.fileMb
+                  << " MiB, load " << copied.loadMs << " ms, +" << copied.loadedMb << " MiB resident" << std::endl;
+    }
+
+    std::cout << "boundary: toStd/fromStd " << boundaryWorkload<InteropCrossing, BenchObject>() << " round trips/ms, with pooled blocks "
+              << boundaryWorkload<InteropCrossing, PooledBenchObject>() << " round trips/ms, wrapping deleters "
+              << boundaryWorkload<WrappingCrossing, BenchObject>() << " round trips/ms" << std::endl;
+    return 0;
+}
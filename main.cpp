@@ -1,9 +1,44 @@
 #include "SharedPtr.h"
+#include "AtomicSharedPtr.h"
+#include "ShardedPolicy.h"
+#include "BiasedPolicy.h"
+#include "RefCounted.h"
+#include "CompactSharedPtr.h"
+#include "Borrowed.h"
+#include "SharedPtrQueue.h"
+#include "SharedCache.h"
+#include "SnapshotPublisher.h"
+#include "RecyclingPool.h"
+#include "GraphSerializer.h"
 #include <iostream>
 #include <cassert>
 #include <thread>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <cstdint>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+//ThreadSanitizer stretches every atomic operation, so counts that depend on when threads get preempted are only bounded without it
+#if defined(__SANITIZE_THREAD__)
+#define TESTS_UNDER_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define TESTS_UNDER_TSAN 1
+#endif
+#endif
+#ifndef TESTS_UNDER_TSAN
+#define TESTS_UNDER_TSAN 0
+#endif
 
 /* TestCases are designed to follow the functionality of std::shared_ptr and cross checking results with SharedPtr
 * The following test cases are covered:
@@ -27,19 +62,388 @@
 * 18. Concurrent copy and assignment
 * 19. Large number of threads
 * 20. Scope deletion with threads
+* 21. MakeShared
+* 22. Empty handles
+* 23. AtomicSharedPtr load, store and exchange
+* 24. AtomicSharedPtr compare exchange
+* 25. AtomicSharedPtr concurrent readers and writers
+* 26. WeakPtr observe, lock and expire
+* 27. WeakPtr outliving a MakeShared object
+* 28. Concurrent WeakPtr lock while owners release
+* 29. Pooled control blocks across threads, large MakeShared blocks bypassing the pool
+* 30. SingleThreaded policy
+* 31. Sharded policy
+* 32. Sharded policy with cross-thread releases and last reference on another thread
+* 33. Sharded policy with threads sharing a shard dropping their last references at once
+* 34. Biased policy on the owner thread and with escaping copies
+* 35. Biased policy releases handed over to a live owner and to an exited one
+* 36. Deferred destruction with flush(), backpressure and destructors that flush
+* 37. Deferred destruction on the reclaimer thread
+* 38. Per-type statistics (exact counts when built with SHAREDPTR_ENABLE_STATS=1, nothing recorded otherwise)
+* 39. Custom deleters
+* 40. AllocateShared with a counting allocator and a std::pmr arena
+* 41. Aliasing constructor
+* 42. Converting constructors and pointer casts
+* 43. SharedPtr<T[]> adopting new T[n] and from MakeSharedArray
+* 44. MakeSharedForOverwrite, alignment and failed element construction
+* 45. Intrusive counting with RefCounted
+* 46. EnableSharedFromThis
+* 47. CompactSharedPtr and conversions to and from SharedPtr
+* 48. Borrowed views and promotion to SharedPtr
+* 49. Batched releases with ScopedReleaseBatching and flushReleases
+* 50. SharedPtrQueue single and bulk transfers, and producers and consumers on several threads
+* 51. SharedCache hits, single-flight loads, demotion to weak and eviction, entries released outside the shard lock
+* 52. SnapshotPublisher cached reads, refresh on publish and reclamation of old snapshots
+* 53. RecyclingPool reuse, reset hook, capacity cap, trim and objects outliving the pool
+* 54. Graph serialization keeping shared nodes shared, counts, memory mapped loading, cycles and corrupt input
+* 55. Converting to and from std::shared_ptr, both sides keeping the object alive, and round trips unwrapping
+* 56. Assigning from a handle that lives inside the object the assignment releases (head = head->next)
+* 57. Assigning a WeakPtr from one that dropping the old block's deleter frees
 */
 
 class TestObject {
 public:
     int value;
-    static bool deleted;
+    static std::atomic<bool> deleted;
     TestObject(int val) : value(val) {}
     ~TestObject() {
         deleted = true;
     }
 };
 
-bool TestObject::deleted = false;
+std::atomic<bool> TestObject::deleted(false);
+
+//same as TestObject, but its control blocks come from the per-thread pool
+class PooledTestObject : public TestObject {
+public:
+    PooledTestObject(int val) : TestObject(val) {}
+};
+
+template <>
+struct PooledControlBlocks<PooledTestObject> : std::true_type {};
+
+//pooled type too large for its MakeShared block to be pooled
+class PooledBuffer {
+public:
+    char bytes[4096];
+    static std::atomic<int> destroyed;
+    ~PooledBuffer() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> PooledBuffer::destroyed(0);
+
+template <>
+struct PooledControlBlocks<PooledBuffer> : std::true_type {};
+
+//counts destructions, for policies where the last release may happen on any thread
+class CountedObject {
+public:
+    int value;
+    static std::atomic<int> destroyed;
+    CountedObject(int val) : value(val) {}
+    ~CountedObject() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> CountedObject::destroyed(0);
+
+//destruction is handed to the Reclaimer
+class DeferredObject : public CountedObject {
+public:
+    DeferredObject(int val) : CountedObject(val) {}
+};
+
+template <>
+struct DeferredDestruction<DeferredObject> : std::true_type {};
+
+//deferred, and flushes the Reclaimer that destroys it from its destructor
+class FlushingObject : public CountedObject {
+public:
+    SharedPtr<DeferredObject> inner;
+    FlushingObject(int val) : CountedObject(val), inner(MakeShared<DeferredObject>(val + 1)) {}
+    ~FlushingObject() {
+        inner.reset();
+        Reclaimer::instance().flush();
+    }
+};
+
+template <>
+struct DeferredDestruction<FlushingObject> : std::true_type {};
+
+//deleters and allocators that count what they do, shared by SharedPtr and std::shared_ptr in the same test
+struct CountingDeleter {
+    int* calls;
+    void operator()(TestObject* ptr) const {
+        ++*calls;
+        delete ptr;
+    }
+};
+
+template <typename T>
+struct CountingAllocator {
+    typedef T value_type;
+    int* allocations;
+    int* deallocations;
+
+    CountingAllocator(int* allocations, int* deallocations) : allocations(allocations), deallocations(deallocations) {}
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : allocations(other.allocations), deallocations(other.deallocations) {}
+
+    T* allocate(std::size_t n) {
+        ++*allocations;
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, std::size_t n) {
+        ++*deallocations;
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return this->allocations == other.allocations;
+    }
+    template <typename U>
+    bool operator!=(const CountingAllocator<U>& other) const {
+        return this->allocations != other.allocations;
+    }
+};
+
+//an object whose member takes the arena it is constructed in
+class ArenaObject {
+public:
+    int value;
+    std::pmr::vector<int> items;
+    typedef std::pmr::polymorphic_allocator<int> allocator_type;
+    ArenaObject(int val, const allocator_type& alloc) : value(val), items(alloc) {}
+};
+
+//a large object handed out piecewise, for the aliasing tests
+class Buffer {
+public:
+    int header;
+    int data[64];
+    Buffer(int val) : header(val) {
+        for (int i = 0; i < 64; ++i) {
+            data[i] = val + i;
+        }
+    }
+};
+
+class Base {
+public:
+    int value;
+    Base(int val) : value(val) {}
+    virtual ~Base() {}
+};
+
+class Derived : public Base {
+public:
+    Derived(int val) : Base(val) {}
+};
+
+//array element that counts constructions and destructions and can be told to throw from its constructor
+class ArrayElement {
+public:
+    int value;
+    static int constructed;
+    static int destroyed;
+    static int throwAt;
+    ArrayElement() : value(7) {
+        if (constructed == throwAt) {
+            throw std::runtime_error("element construction failed");
+        }
+        constructed++;
+    }
+    ~ArrayElement() {
+        destroyed++;
+    }
+};
+
+int ArrayElement::constructed = 0;
+int ArrayElement::destroyed = 0;
+int ArrayElement::throwAt = -1;
+
+//releases are batched while a ScopedReleaseBatching is open
+class BatchedObject : public CountedObject {
+public:
+    SharedPtr<BatchedObject> next;
+    BatchedObject(int val) : CountedObject(val) {}
+};
+
+template <>
+struct BatchedReleases<BatchedObject> : std::true_type {};
+
+//intrusively counted node, a handle to it is a single pointer
+class IntrusiveNode : public RefCounted<IntrusiveNode> {
+public:
+    int value;
+    SharedPtr<IntrusiveNode, Intrusive<>> next;
+    static std::atomic<int> destroyed;
+    IntrusiveNode(int val) : value(val) {}
+    virtual ~IntrusiveNode() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> IntrusiveNode::destroyed(0);
+
+class IntrusiveLeaf : public IntrusiveNode {
+public:
+    IntrusiveLeaf(int val) : IntrusiveNode(val) {}
+};
+
+class LocalNode : public RefCounted<LocalNode, SingleThreaded> {
+public:
+    int value;
+    LocalNode(int val) : value(val) {}
+};
+
+class Session : public EnableSharedFromThis<Session> {
+public:
+    int id;
+    Session(int id) : id(id) {}
+};
+
+class StdSession : public std::enable_shared_from_this<StdSession> {
+public:
+    int id;
+    StdSession(int id) : id(id) {}
+};
+
+class LocalSession : public EnableSharedFromThis<LocalSession, SingleThreaded> {
+public:
+    int id;
+    LocalSession(int id) : id(id) {}
+};
+
+//a buffer worth recycling, it counts how often one is really built and destroyed
+class PooledFrame {
+public:
+    std::vector<int> data;
+    static std::atomic<int> constructed;
+    static std::atomic<int> destroyed;
+    PooledFrame() {
+        constructed++;
+    }
+    ~PooledFrame() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> PooledFrame::constructed(0);
+std::atomic<int> PooledFrame::destroyed(0);
+
+//empties a frame coming back to its pool but keeps its capacity
+struct ClearFrame {
+    void operator()(PooledFrame& frame) const {
+        frame.data.clear();
+    }
+};
+
+//list node whose only owner is the previous node, so head = head->next frees the node holding the source handle
+class ListNode {
+public:
+    int value;
+    SharedPtr<ListNode> next;
+    static std::atomic<int> destroyed;
+    ListNode(int val) : value(val) {}
+    ~ListNode() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> ListNode::destroyed(0);
+
+//ListNode linked through compact handles
+class CompactNode {
+public:
+    int value;
+    CompactSharedPtr<CompactNode> next;
+    static std::atomic<int> destroyed;
+    CompactNode(int val) : value(val) {}
+    ~CompactNode() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> CompactNode::destroyed(0);
+
+//holds a WeakPtr and is kept alive only by the deleter of the object that WeakPtr's neighbour observes
+class WeakHolder {
+public:
+    WeakPtr<CountedObject> observer;
+    static std::atomic<int> destroyed;
+    ~WeakHolder() {
+        destroyed++;
+    }
+};
+
+std::atomic<int> WeakHolder::destroyed(0);
+
+//node of the graphs testGraphSerializer saves and loads
+class GraphNode {
+public:
+    int value;
+    std::string label;
+    SharedPtr<GraphNode> left, right;
+    GraphNode(int val, std::string label) : value(val), label(std::move(label)) {}
+};
+
+template <>
+struct GraphCodec<GraphNode> {
+    template <typename Visit>
+    static void forEachChild(const GraphNode& node, Visit&& visit) {
+        visit(node.left);
+        visit(node.right);
+    }
+    static void save(const GraphNode& node, GraphWriter<GraphNode>& out) {
+        out.writeValue(node.value);
+        out.writeString(node.label);
+        out.writeChild(node.left);
+        out.writeChild(node.right);
+    }
+    static SharedPtr<GraphNode> load(GraphReader<GraphNode>& in) {
+        int value = in.readValue<int>();
+        SharedPtr<GraphNode> node = MakeShared<GraphNode>(value, in.readString());
+        node->left = in.readChild();
+        node->right = in.readChild();
+        return node;
+    }
+};
+
+//children reach the writer as temporaries made from the compact handles
+template <>
+struct GraphCodec<CompactNode> {
+    template <typename Visit>
+    static void forEachChild(const CompactNode& node, Visit&& visit) {
+        visit(node.next.toShared());
+    }
+    static void save(const CompactNode& node, GraphWriter<CompactNode>& out) {
+        out.writeValue(node.value);
+        out.writeChild(node.next.toShared());
+    }
+    static SharedPtr<CompactNode> load(GraphReader<CompactNode>& in) {
+        SharedPtr<CompactNode> node = MakeShared<CompactNode>(in.readValue<int>());
+        node->next = CompactSharedPtr<CompactNode>(in.readChild());
+        return node;
+    }
+};
+
+//only used by testRefCountStats, so its statistics are predictable
+class StatsObject {
+public:
+    int value;
+    StatsObject(int val) : value(val) {}
+};
+
+//held by a thread_local handle that is released after the thread's statistics are folded in
+class LateStatsObject {
+public:
+    int value;
+    LateStatsObject(int val) : value(val) {}
+};
 
 void testDefaultConstructor() {
     SharedPtr<TestObject> sp;
@@ -383,14 +787,19 @@ void testConcurrentAccess() {
 }
 
 void testConcurrentModification() {
+    //like std::shared_ptr, a single handle modified from several threads needs external synchronization
     SharedPtr<TestObject> sp(new TestObject(180));
+    std::shared_ptr<TestObject> sp2(new TestObject(180));
+    std::mutex mtx;
     const int numThreads = 10;
     std::vector<std::thread> threads;
 
     for (int i = 0; i < numThreads; ++i) {
-        threads.emplace_back([&sp]() {
+        threads.emplace_back([&sp, &sp2, &mtx]() {
             for (int j = 0; j < 1000; ++j) {
+                std::lock_guard<std::mutex> guard(mtx);
                 sp.reset(new TestObject(180 + j));
+                sp2.reset(new TestObject(180 + j));
             }
         });
     }
@@ -399,6 +808,11 @@ void testConcurrentModification() {
         thread.join();
     }
 
+    assert(sp.get() != nullptr);
+    assert(sp.getCount() == 1);
+    assert(sp2.get() != nullptr);
+    assert(sp2.use_count() == 1);
+
     std::cout << "testConcurrentModification passed!" << std::endl;
 }
 
@@ -469,6 +883,2229 @@ void testScopeDeletionWithThreads() {
     std::cout << "testScopeDeletionWithThreads passed!" << std::endl;
 }
 
+void testMakeShared() {
+    TestObject::deleted = false;
+    {
+        SharedPtr<TestObject> sp1 = MakeShared<TestObject>(210);
+        std::shared_ptr<TestObject> sp3 = std::make_shared<TestObject>(210);
+        assert(sp1.get() != nullptr);
+        assert(sp1->value == 210);
+        assert(sp1.getCount() == 1);
+        assert(sp3.get() != nullptr);
+        assert(sp3->value == 210);
+        assert(sp3.use_count() == 1);
+
+        SharedPtr<TestObject> sp2(sp1);
+        std::shared_ptr<TestObject> sp4(sp3);
+        assert(sp2.get() == sp1.get());
+        assert(sp2.getCount() == 2);
+        assert(sp4.get() == sp3.get());
+        assert(sp4.use_count() == 2);
+
+        sp1.reset();
+        sp3.reset();
+        assert(sp2.getCount() == 1);
+        assert(sp4.use_count() == 1);
+        assert(!TestObject::deleted);
+    }
+    assert(TestObject::deleted);
+    std::cout << "testMakeShared passed!" << std::endl;
+}
+
+void testEmptyHandles() {
+    std::vector<SharedPtr<TestObject>> spArray(1000);
+    std::vector<std::shared_ptr<TestObject>> spArray2(1000);
+    for (size_t i = 0; i < spArray.size(); ++i) {
+        assert(spArray[i].get() == spArray2[i].get());
+        assert(spArray[i].getCount() == spArray2[i].use_count());
+    }
+
+    SharedPtr<TestObject> sp1(new TestObject(220));
+    SharedPtr<TestObject> sp2(std::move(sp1));
+    sp2.reset(nullptr);
+    std::shared_ptr<TestObject> sp3(new TestObject(220));
+    std::shared_ptr<TestObject> sp4(std::move(sp3));
+    sp4.reset();
+    assert(sp1.get() == nullptr);
+    assert(sp1.getCount() == 0);
+    assert(sp2.get() == nullptr);
+    assert(sp2.getCount() == 0);
+    assert(sp3.get() == nullptr);
+    assert(sp3.use_count() == 0);
+    assert(sp4.get() == nullptr);
+    assert(sp4.use_count() == 0);
+
+    sp2.reset();
+    sp1 = sp2;
+    assert(sp1.getCount() == 0);
+    std::cout << "testEmptyHandles passed!" << std::endl;
+}
+
+void testAtomicLoadStoreExchange() {
+    AtomicSharedPtr<TestObject> slot;
+    std::shared_ptr<TestObject> stdSlot;
+    assert(slot.is_lock_free());
+    assert(slot.load().get() == std::atomic_load(&stdSlot).get());
+
+    SharedPtr<TestObject> sp1 = MakeShared<TestObject>(230);
+    std::shared_ptr<TestObject> sp3 = std::make_shared<TestObject>(230);
+    slot.store(sp1);
+    std::atomic_store(&stdSlot, sp3);
+    assert(sp1.getCount() == 2);
+    assert(sp3.use_count() == 2);
+    SharedPtr<TestObject> sp2 = slot.load();
+    std::shared_ptr<TestObject> sp4 = std::atomic_load(&stdSlot);
+    assert(sp2.get() == sp1.get());
+    assert(sp1.getCount() == 3);
+    assert(sp4.get() == sp3.get());
+    assert(sp3.use_count() == 3);
+
+    SharedPtr<TestObject> old = slot.exchange(MakeShared<TestObject>(240));
+    std::shared_ptr<TestObject> old2 = std::atomic_exchange(&stdSlot, std::make_shared<TestObject>(240));
+    assert(old.get() == sp1.get());
+    assert(sp1.getCount() == 3);
+    assert(old2.get() == sp3.get());
+    assert(sp3.use_count() == 3);
+    assert(slot.load()->value == 240);
+    assert(std::atomic_load(&stdSlot)->value == 240);
+
+    slot.store(nullptr);
+    std::atomic_store(&stdSlot, std::shared_ptr<TestObject>());
+    assert(slot.load().get() == nullptr);
+    assert(slot.load().getCount() == 0);
+    assert(std::atomic_load(&stdSlot).get() == nullptr);
+    std::cout << "testAtomicLoadStoreExchange passed!" << std::endl;
+}
+
+void testAtomicCompareExchange() {
+    SharedPtr<TestObject> sp1 = MakeShared<TestObject>(250);
+    AtomicSharedPtr<TestObject> slot(sp1);
+    std::shared_ptr<TestObject> sp3 = std::make_shared<TestObject>(250);
+    std::shared_ptr<TestObject> stdSlot(sp3);
+
+    SharedPtr<TestObject> expected = MakeShared<TestObject>(250);
+    assert(!slot.compare_exchange_strong(expected, MakeShared<TestObject>(260)));
+    assert(expected.get() == sp1.get());
+    assert(slot.load().get() == sp1.get());
+    assert(slot.compare_exchange_strong(expected, MakeShared<TestObject>(260)));
+    assert(slot.load()->value == 260);
+    std::shared_ptr<TestObject> expected2 = sp3;
+    assert(std::atomic_compare_exchange_strong(&stdSlot, &expected2, std::make_shared<TestObject>(260)));
+    assert(std::atomic_load(&stdSlot)->value == 260);
+    assert(sp1.getCount() == 2);
+    assert(sp3.use_count() == 2);
+
+    const int numThreads = 10;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&slot]() {
+            for (int j = 0; j < 1000; ++j) {
+                SharedPtr<TestObject> cur = slot.load();
+                while (!slot.compare_exchange_weak(cur, MakeShared<TestObject>(cur->value + 1))) {
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(slot.load()->value == 260 + numThreads * 1000);
+    std::cout << "testAtomicCompareExchange passed!" << std::endl;
+}
+
+void testAtomicConcurrentReadersAndWriters() {
+    AtomicSharedPtr<TestObject> slot(MakeShared<TestObject>(0));
+    const int numReaders = 8;
+    const int numWriters = 2;
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < numReaders; ++i) {
+        threads.emplace_back([&slot, &done]() {
+            while (!done.load()) {
+                SharedPtr<TestObject> sp = slot.load();
+                assert(sp.get() != nullptr);
+                assert(sp.getCount() >= 1);
+                assert(sp->value >= 0 && sp->value < 2000);
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (int i = 0; i < numWriters; ++i) {
+        writers.emplace_back([&slot, i]() {
+            for (int j = 0; j < 1000; ++j) {
+                slot.store(MakeShared<TestObject>(i * 1000 + j));
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(slot.load().getCount() == 2);
+    std::cout << "testAtomicConcurrentReadersAndWriters passed!" << std::endl;
+}
+
+void testWeakPtr() {
+    SharedPtr<TestObject> sp1(new TestObject(270));
+    WeakPtr<TestObject> wp1(sp1);
+    std::shared_ptr<TestObject> sp3(new TestObject(270));
+    std::weak_ptr<TestObject> wp3(sp3);
+    assert(!wp1.expired());
+    assert(wp1.use_count() == 1);
+    assert(!wp3.expired());
+    assert(wp3.use_count() == 1);
+
+    SharedPtr<TestObject> sp2 = wp1.lock();
+    std::shared_ptr<TestObject> sp4 = wp3.lock();
+    assert(sp2.get() == sp1.get());
+    assert(sp1.getCount() == 2);
+    assert(wp1.use_count() == 2);
+    assert(sp4.get() == sp3.get());
+    assert(sp3.use_count() == 2);
+    assert(wp3.use_count() == 2);
+
+    WeakPtr<TestObject> wp2(wp1);
+    std::weak_ptr<TestObject> wp4(wp3);
+    sp1.reset();
+    sp2.reset();
+    sp3.reset();
+    sp4.reset();
+    assert(wp1.expired());
+    assert(wp2.expired());
+    assert(wp1.use_count() == 0);
+    assert(wp1.lock().get() == nullptr);
+    assert(wp3.expired());
+    assert(wp4.expired());
+    assert(wp3.use_count() == 0);
+    assert(wp3.lock().get() == nullptr);
+
+    WeakPtr<TestObject> wp5;
+    std::weak_ptr<TestObject> wp6;
+    assert(wp5.expired());
+    assert(wp5.lock().getCount() == 0);
+    assert(wp6.expired());
+    assert(wp6.lock().use_count() == 0);
+    std::cout << "testWeakPtr passed!" << std::endl;
+}
+
+void testWeakPtrOutlivesMakeShared() {
+    TestObject::deleted = false;
+    WeakPtr<TestObject> wp1;
+    std::weak_ptr<TestObject> wp2;
+    {
+        SharedPtr<TestObject> sp1 = MakeShared<TestObject>(280);
+        std::shared_ptr<TestObject> sp2 = std::make_shared<TestObject>(280);
+        wp1 = sp1;
+        wp2 = sp2;
+        assert(wp1.lock()->value == 280);
+        assert(wp2.lock()->value == 280);
+    }
+    //the object is gone as soon as the last owner is, only the block stays around for the observers
+    assert(TestObject::deleted);
+    assert(wp1.expired());
+    assert(wp2.expired());
+    WeakPtr<TestObject> wp3(std::move(wp1));
+    assert(wp1.expired());
+    assert(wp3.expired());
+    std::cout << "testWeakPtrOutlivesMakeShared passed!" << std::endl;
+}
+
+void testConcurrentWeakLock() {
+    const int numRounds = 200;
+    const int numThreads = 4;
+    for (int round = 0; round < numRounds; ++round) {
+        SharedPtr<TestObject> owner = MakeShared<TestObject>(290);
+        WeakPtr<TestObject> observer(owner);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([observer]() {
+                for (int j = 0; j < 100; ++j) {
+                    SharedPtr<TestObject> sp = observer.lock();
+                    if (sp.get() != nullptr) {
+                        assert(sp->value == 290);
+                    } else {
+                        assert(observer.expired());
+                    }
+                }
+            });
+        }
+        owner.reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(observer.expired());
+    }
+    std::cout << "testConcurrentWeakLock passed!" << std::endl;
+}
+
+void testPooledControlBlocks() {
+    const int numThreads = 8;
+    const int numObjects = 1000;
+    std::vector<std::vector<SharedPtr<PooledTestObject>>> handOff(numThreads);
+    std::vector<std::thread> threads;
+
+    //each thread allocates blocks, keeps its own objects and the next thread releases them, so blocks change threads
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&handOff, i]() {
+            for (int j = 0; j < numObjects; ++j) {
+                SharedPtr<PooledTestObject> sp(new PooledTestObject(300 + j));
+                SharedPtr<PooledTestObject> sp2 = MakeShared<PooledTestObject>(300 + j);
+                assert(sp->value == sp2->value);
+                assert(sp.getCount() == 1);
+                handOff[i].push_back(sp);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&handOff, i]() {
+            std::vector<SharedPtr<PooledTestObject>>& mine = handOff[(i + 1) % numThreads];
+            for (int j = 0; j < numObjects; ++j) {
+                assert(mine[j]->value == 300 + j);
+                assert(mine[j].getCount() == 1);
+            }
+            mine.clear();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    SharedPtr<PooledTestObject> sp(new PooledTestObject(310));
+    WeakPtr<PooledTestObject> wp(sp);
+    sp.reset();
+    assert(wp.expired());
+
+    //a large object's MakeShared block goes to the global allocator, its pointer-adopting block still comes from the pool
+    static_assert(detail::PoolsBlock<PooledTestObject, detail::InplaceBlock<PooledTestObject, MultiThreaded>>::value,
+        "small MakeShared blocks are pooled");
+    static_assert(!detail::PoolsBlock<PooledBuffer, detail::InplaceBlock<PooledBuffer, MultiThreaded>>::value,
+        "large MakeShared blocks are not pooled");
+    static_assert(detail::PoolsBlock<PooledBuffer, detail::PointerBlock<PooledBuffer, MultiThreaded>>::value,
+        "pointer blocks of large types are pooled");
+    PooledBuffer::destroyed = 0;
+    for (int i = 0; i < 300; ++i) {
+        SharedPtr<PooledBuffer> buffer = MakeShared<PooledBuffer>();
+        SharedPtr<PooledBuffer> adopted(new PooledBuffer());
+        buffer->bytes[0] = adopted->bytes[0] = static_cast<char>(i);
+    }
+    assert(PooledBuffer::destroyed == 600);
+    std::cout << "testPooledControlBlocks passed!" << std::endl;
+}
+
+void testSingleThreadedPolicy() {
+    TestObject::deleted = false;
+    {
+        SharedPtr<TestObject, SingleThreaded> sp1(new TestObject(320));
+        SharedPtr<TestObject, SingleThreaded> sp2 = MakeShared<TestObject, SingleThreaded>(330);
+        std::shared_ptr<TestObject> sp3(new TestObject(320));
+        std::shared_ptr<TestObject> sp4 = std::make_shared<TestObject>(330);
+        assert(sp1->value == 320);
+        assert(sp1.getCount() == 1);
+        assert(sp2->value == 330);
+        assert(sp3->value == 320);
+        assert(sp3.use_count() == 1);
+        assert(sp4->value == 330);
+
+        SharedPtr<TestObject, SingleThreaded> sp5(sp1);
+        std::shared_ptr<TestObject> sp6(sp3);
+        sp2 = sp1;
+        sp4 = sp3;
+        assert(sp1.getCount() == 3);
+        assert(sp3.use_count() == 3);
+        assert(TestObject::deleted);
+        TestObject::deleted = false;
+
+        WeakPtr<TestObject, SingleThreaded> wp1(sp1);
+        std::weak_ptr<TestObject> wp2(sp3);
+        sp1.reset();
+        sp2.reset();
+        sp3.reset();
+        sp4.reset();
+        assert(wp1.use_count() == 1);
+        assert(wp1.lock().get() == sp5.get());
+        assert(wp2.use_count() == 1);
+        assert(wp2.lock().get() == sp6.get());
+        assert(!TestObject::deleted);
+
+        SharedPtr<TestObject, SingleThreaded> sp7(std::move(sp5));
+        std::shared_ptr<TestObject> sp8(std::move(sp6));
+        sp7.reset();
+        sp8.reset();
+        assert(wp1.expired());
+        assert(wp2.expired());
+        assert(TestObject::deleted);
+    }
+    std::cout << "testSingleThreadedPolicy passed!" << std::endl;
+}
+
+void testShardedPolicy() {
+    CountedObject::destroyed = 0;
+    {
+        SharedPtr<CountedObject, Sharded<>> sp1 = MakeShared<CountedObject, Sharded<>>(340);
+        std::shared_ptr<CountedObject> sp3 = std::make_shared<CountedObject>(340);
+        assert(sp1->value == 340);
+        assert(sp1.getCount() == 1);
+        assert(sp3.use_count() == 1);
+
+        SharedPtr<CountedObject, Sharded<>> sp2(sp1);
+        std::shared_ptr<CountedObject> sp4(sp3);
+        assert(sp1.getCount() == 2);
+        assert(sp3.use_count() == 2);
+
+        WeakPtr<CountedObject, Sharded<>> wp1(sp1);
+        std::weak_ptr<CountedObject> wp2(sp3);
+        sp1.reset();
+        sp3.reset();
+        assert(sp2.getCount() == 1);
+        assert(sp4.use_count() == 1);
+        assert(wp1.lock().get() == sp2.get());
+        assert(wp2.lock().get() == sp4.get());
+        assert(CountedObject::destroyed == 0);
+
+        sp2.reset();
+        sp4.reset();
+        assert(wp1.expired());
+        assert(wp2.expired());
+        assert(CountedObject::destroyed == 2);
+    }
+
+    //a long-lived base reference with every thread copying and releasing on its own shard
+    SharedPtr<CountedObject, Sharded<4>> singleton(new CountedObject(350));
+    const int numThreads = 16;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&singleton]() {
+            for (int j = 0; j < 1000; ++j) {
+                SharedPtr<CountedObject, Sharded<4>> spCopy(singleton);
+                assert(spCopy->value == 350);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(singleton.getCount() == 1);
+    singleton.reset();
+    assert(CountedObject::destroyed == 3);
+    std::cout << "testShardedPolicy passed!" << std::endl;
+}
+
+void testShardedSharedShardRelease() {
+    const int numRounds = 300;
+    const int numThreads = 6;
+    const int copiesPerThread = 4;
+    CountedObject::destroyed = 0;
+    //more threads than shards, so several threads fold the same shard while others release on it
+    for (int round = 0; round < numRounds; ++round) {
+        SharedPtr<CountedObject, Sharded<2>> owner = MakeShared<CountedObject, Sharded<2>>(365);
+        std::atomic<int> ready(0);
+        std::atomic<bool> go(false);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&owner, &ready, &go]() {
+                std::vector<SharedPtr<CountedObject, Sharded<2>>> copies(copiesPerThread, owner);
+                ready++;
+                while (!go.load()) {
+                    std::this_thread::yield();
+                }
+                for (auto& copy : copies) {
+                    copy.reset();
+                }
+            });
+        }
+        while (ready.load() < numThreads) {
+            std::this_thread::yield();
+        }
+        owner.reset();
+        assert(CountedObject::destroyed == round);
+        go = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(CountedObject::destroyed == round + 1);
+    }
+    std::cout << "testShardedSharedShardRelease passed!" << std::endl;
+}
+
+void testShardedCrossThreadRelease() {
+    const int numRounds = 100;
+    const int numThreads = 8;
+    CountedObject::destroyed = 0;
+    for (int round = 0; round < numRounds; ++round) {
+        SharedPtr<CountedObject, Sharded<4>> owner = MakeShared<CountedObject, Sharded<4>>(360);
+        WeakPtr<CountedObject, Sharded<4>> observer(owner);
+        std::vector<std::vector<SharedPtr<CountedObject, Sharded<4>>>> handOff(numThreads);
+        //copies are counted on the copying thread's shard
+        for (int i = 0; i < numThreads; ++i) {
+            for (int j = 0; j < 10; ++j) {
+                handOff[i].push_back(owner);
+            }
+        }
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&handOff, &observer, i]() {
+                //released on other threads' shards, and racing weak locks
+                for (auto& sp : handOff[i]) {
+                    SharedPtr<CountedObject, Sharded<4>> locked = observer.lock();
+                    assert(locked.get() != nullptr);
+                    sp.reset();
+                }
+            });
+        }
+        //the base reference goes first, the last release lands on some worker thread
+        owner.reset();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(observer.expired());
+        assert(CountedObject::destroyed == round + 1);
+    }
+    std::cout << "testShardedCrossThreadRelease passed!" << std::endl;
+}
+
+void testBiasedPolicy() {
+    CountedObject::destroyed = 0;
+    {
+        SharedPtr<CountedObject, Biased> sp1 = MakeShared<CountedObject, Biased>(370);
+        std::shared_ptr<CountedObject> sp3 = std::make_shared<CountedObject>(370);
+        assert(sp1->value == 370);
+        assert(sp1.getCount() == 1);
+        assert(sp3.use_count() == 1);
+
+        SharedPtr<CountedObject, Biased> sp2(sp1);
+        std::shared_ptr<CountedObject> sp4(sp3);
+        assert(sp1.getCount() == 2);
+        assert(sp3.use_count() == 2);
+
+        WeakPtr<CountedObject, Biased> wp1(sp1);
+        std::weak_ptr<CountedObject> wp2(sp3);
+        sp1.reset();
+        sp3.reset();
+        assert(sp2.getCount() == 1);
+        assert(sp4.use_count() == 1);
+        assert(wp1.lock().get() == sp2.get());
+        assert(wp2.lock().get() == sp4.get());
+
+        sp2.reset();
+        sp4.reset();
+        assert(wp1.expired());
+        assert(wp2.expired());
+        assert(CountedObject::destroyed == 2);
+    }
+
+    //copies escaping to other threads are counted on the shared count, the owner's last release merges and frees
+    SharedPtr<CountedObject, Biased> sp5(new CountedObject(380));
+    const int numThreads = 8;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&sp5]() {
+            for (int j = 0; j < 1000; ++j) {
+                SharedPtr<CountedObject, Biased> spCopy(sp5);
+                assert(spCopy->value == 380);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(sp5.getCount() == 1);
+    sp5.reset();
+    assert(CountedObject::destroyed == 3);
+
+    //the owner lets go first, the last release happens on another thread after the merge
+    SharedPtr<CountedObject, Biased> sp6 = MakeShared<CountedObject, Biased>(390);
+    std::vector<SharedPtr<CountedObject, Biased>> escaped(numThreads);
+    threads.clear();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&escaped, &sp6, i]() {
+            escaped[i] = sp6;
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    sp6.reset();
+    assert(CountedObject::destroyed == 3);
+    threads.clear();
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&escaped, i]() {
+            escaped[i].reset();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(CountedObject::destroyed == 4);
+    std::cout << "testBiasedPolicy passed!" << std::endl;
+}
+
+void testBiasedHandOver() {
+    CountedObject::destroyed = 0;
+    std::mutex mtx;
+    std::condition_variable cv;
+    int stage = 0;
+    SharedPtr<CountedObject, Biased> moved;
+    WeakPtr<CountedObject, Biased> observer;
+
+    //the owner stays alive, a release of its locally counted reference waits in its pending list
+    std::thread owner([&]() {
+        {
+            SharedPtr<CountedObject, Biased> sp = MakeShared<CountedObject, Biased>(400);
+            observer = sp;
+            std::lock_guard<std::mutex> guard(mtx);
+            moved = std::move(sp);
+            stage = 1;
+        }
+        cv.notify_all();
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&stage] { return stage == 2; });
+        assert(CountedObject::destroyed == 0);
+        Biased::processPending();
+        assert(CountedObject::destroyed == 1);
+        assert(observer.expired());
+        stage = 3;
+        cv.notify_all();
+    });
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&stage] { return stage == 1; });
+        moved.reset();
+        assert(!observer.expired());
+        stage = 2;
+    }
+    cv.notify_all();
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&stage] { return stage == 3; });
+    }
+    owner.join();
+
+    //an owner that exited merged everything biased to it, so the last release frees the object right away
+    std::thread exited([&moved]() {
+        moved = MakeShared<CountedObject, Biased>(410);
+    });
+    exited.join();
+    SharedPtr<CountedObject, Biased> copy(moved);
+    assert(moved.getCount() == 2);
+    moved.reset();
+    copy.reset();
+    assert(CountedObject::destroyed == 2);
+
+    //handed over releases still pending when the owner exits are applied on its way out
+    std::vector<SharedPtr<CountedObject, Biased>> handOff;
+    std::thread leaving([&]() {
+        for (int i = 0; i < 10; ++i) {
+            handOff.push_back(MakeShared<CountedObject, Biased>(420 + i));
+        }
+        std::unique_lock<std::mutex> lock(mtx);
+        stage = 4;
+        cv.notify_all();
+        cv.wait(lock, [&stage] { return stage == 5; });
+    });
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&stage] { return stage == 4; });
+        handOff.clear();
+        assert(CountedObject::destroyed == 2);
+        stage = 5;
+    }
+    cv.notify_all();
+    leaving.join();
+    assert(CountedObject::destroyed == 12);
+    std::cout << "testBiasedHandOver passed!" << std::endl;
+}
+
+void testDeferredDestruction() {
+    Reclaimer& reclaimer = Reclaimer::instance();
+    Reclaimer::Stats before = reclaimer.stats();
+    CountedObject::destroyed = 0;
+    {
+        SharedPtr<DeferredObject> sp1(new DeferredObject(430));
+        SharedPtr<DeferredObject> sp2 = MakeShared<DeferredObject>(440);
+        WeakPtr<DeferredObject> wp(sp2);
+        SharedPtr<DeferredObject> sp3(sp1);
+        sp1.reset();
+        assert(reclaimer.pending() == 0);
+        sp3.reset();
+        sp2.reset();
+        //owners are gone right away, the objects only once the queue is drained
+        assert(wp.expired());
+        assert(wp.lock().get() == nullptr);
+        assert(CountedObject::destroyed == 0);
+        assert(reclaimer.pending() == 2);
+        reclaimer.flush();
+        assert(CountedObject::destroyed == 2);
+        assert(reclaimer.pending() == 0);
+    }
+    Reclaimer::Stats after = reclaimer.stats();
+    assert(after.queued - before.queued == 2);
+    assert(after.reclaimed - before.reclaimed == 2);
+
+    //a full queue makes releases destroy inline
+    reclaimer.setCapacity(4);
+    std::vector<SharedPtr<DeferredObject>> objects;
+    for (int i = 0; i < 10; ++i) {
+        objects.push_back(MakeShared<DeferredObject>(450 + i));
+    }
+    objects.clear();
+    assert(CountedObject::destroyed == 8);
+    assert(reclaimer.pending() == 4);
+    reclaimer.flush();
+    assert(CountedObject::destroyed == 12);
+    before = after;
+    after = reclaimer.stats();
+    assert(after.queued - before.queued == 4);
+    assert(after.destroyedInline - before.destroyedInline == 6);
+    reclaimer.setCapacity(4096);
+
+    //destructors may flush the reclaimer running them, here and on its own thread
+    CountedObject::destroyed = 0;
+    SharedPtr<FlushingObject> flushing = MakeShared<FlushingObject>(470);
+    flushing.reset();
+    reclaimer.flush();
+    assert(CountedObject::destroyed == 2);
+    reclaimer.startThread();
+    flushing = MakeShared<FlushingObject>(480);
+    flushing.reset();
+    reclaimer.stopThread();
+    assert(CountedObject::destroyed == 4);
+    assert(reclaimer.pending() == 0);
+    std::cout << "testDeferredDestruction passed!" << std::endl;
+}
+
+void testBackgroundReclaimer() {
+    Reclaimer& reclaimer = Reclaimer::instance();
+    Reclaimer::Stats before = reclaimer.stats();
+    CountedObject::destroyed = 0;
+    reclaimer.startThread();
+    const int numThreads = 8;
+    const int objectsPerThread = 1000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([]() {
+            for (int j = 0; j < objectsPerThread; ++j) {
+                SharedPtr<DeferredObject> sp = MakeShared<DeferredObject>(j);
+                SharedPtr<DeferredObject> spCopy(new DeferredObject(j));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    reclaimer.stopThread();
+    assert(CountedObject::destroyed == 2 * numThreads * objectsPerThread);
+    assert(reclaimer.pending() == 0);
+    Reclaimer::Stats after = reclaimer.stats();
+    assert(after.queued - before.queued == after.reclaimed - before.reclaimed);
+    assert(after.queued - before.queued + after.destroyedInline - before.destroyedInline == 2 * numThreads * objectsPerThread);
+    std::cout << "testBackgroundReclaimer passed!" << std::endl;
+}
+
+void testRefCountStats() {
+    {
+        SharedPtr<StatsObject> sp1 = MakeShared<StatsObject>(460);
+        SharedPtr<StatsObject> sp2(new StatsObject(470));
+        SharedPtr<StatsObject> sp3(sp1);
+        SharedPtr<StatsObject> sp4(std::move(sp3));
+        sp2 = sp4;
+        std::thread copier([&sp1]() {
+            for (int i = 0; i < 10; ++i) {
+                SharedPtr<StatsObject> spCopy(sp1);
+            }
+        });
+        copier.join();
+        sp4.reset();
+        if (RefCountStats::enabled()) {
+            TypeStats stats = RefCountStats::collect<StatsObject>();
+            assert(stats.live == 1);
+            assert(stats.peakLive == 2);
+        }
+    }
+    TypeStats stats = RefCountStats::collect<StatsObject>();
+    if (RefCountStats::enabled()) {
+        assert(stats.created == 2);
+        assert(stats.live == 0);
+        assert(stats.peakLive == 2);
+        //sp3, sp2 = sp4 and the copier thread's ten, which were folded in when it exited
+        assert(stats.copies == 12);
+        assert(stats.moves == 1);
+        assert(stats.resets == 1);
+        //sp2's old object, the copier's ten, sp4, then sp2 and sp1 at the end of the scope
+        assert(stats.releases == 14);
+        assert(stats.frees == 2);
+        RefCountStats::dump(std::cout);
+    } else {
+        assert(stats.created == 0 && stats.copies == 0 && stats.frees == 0);
+    }
+
+    //constructed before the thread's first event, so it is destroyed after its counters were retired
+    std::thread late([]() {
+        thread_local SharedPtr<LateStatsObject> kept;
+        kept = MakeShared<LateStatsObject>(480);
+    });
+    late.join();
+    if (RefCountStats::enabled()) {
+        TypeStats lateStats = RefCountStats::collect<LateStatsObject>();
+        assert(lateStats.created == 1 && lateStats.live == 0);
+        assert(lateStats.releases == 1 && lateStats.frees == 1);
+    }
+    std::cout << "testRefCountStats passed!" << std::endl;
+}
+
+void testCustomDeleter() {
+    int calls = 0;
+    int stdCalls = 0;
+    {
+        SharedPtr<TestObject> sp1(new TestObject(480), CountingDeleter{&calls});
+        std::shared_ptr<TestObject> sp2(new TestObject(480), CountingDeleter{&stdCalls});
+        SharedPtr<TestObject> sp3(sp1);
+        std::shared_ptr<TestObject> sp4(sp2);
+        assert(sp1.getCount() == 2);
+        assert(sp2.use_count() == 2);
+        sp1.reset();
+        sp2.reset();
+        assert(calls == 0);
+        assert(stdCalls == 0);
+    }
+    assert(calls == 1);
+    assert(stdCalls == 1);
+
+    //memory from malloc goes back through free, a captureless lambda adds nothing to the block
+    void* raw = std::malloc(sizeof(TestObject));
+    TestObject* constructed = ::new (raw) TestObject(490);
+    SharedPtr<TestObject> sp5(constructed, [](TestObject* ptr) {
+        ptr->~TestObject();
+        std::free(ptr);
+    });
+    assert(sp5->value == 490);
+    TestObject::deleted = false;
+    sp5.reset();
+    assert(TestObject::deleted);
+    auto noop = [](TestObject*) {};
+    assert(sizeof(detail::DeleterBlock<TestObject, decltype(noop), std::allocator<char>, MultiThreaded>) == sizeof(detail::PointerBlock<TestObject, MultiThreaded>));
+
+    //a null pointer with a deleter stays empty
+    SharedPtr<TestObject> sp6(static_cast<TestObject*>(nullptr), CountingDeleter{&calls});
+    assert(sp6.getCount() == 0);
+    sp6.reset(new TestObject(500), CountingDeleter{&calls});
+    assert(sp6.getCount() == 1);
+    sp6.reset();
+    assert(calls == 2);
+
+    //the block itself through a custom allocator
+    int allocations = 0;
+    int deallocations = 0;
+    {
+        SharedPtr<TestObject> sp7(new TestObject(510), CountingDeleter{&calls}, CountingAllocator<int>(&allocations, &deallocations));
+        WeakPtr<TestObject> wp(sp7);
+        assert(allocations == 1);
+        sp7.reset();
+        assert(calls == 3);
+        assert(deallocations == 0);
+    }
+    assert(deallocations == 1);
+    std::cout << "testCustomDeleter passed!" << std::endl;
+}
+
+void testAllocateShared() {
+    int allocations = 0;
+    int deallocations = 0;
+    int stdAllocations = 0;
+    int stdDeallocations = 0;
+    {
+        SharedPtr<TestObject> sp1 = AllocateShared<TestObject>(CountingAllocator<TestObject>(&allocations, &deallocations), 520);
+        std::shared_ptr<TestObject> sp2 = std::allocate_shared<TestObject>(CountingAllocator<TestObject>(&stdAllocations, &stdDeallocations), 520);
+        assert(sp1->value == 520);
+        assert(sp2->value == 520);
+        assert(sp1.getCount() == 1);
+        assert(sp2.use_count() == 1);
+        assert(allocations == 1);
+        assert(stdAllocations == 1);
+
+        WeakPtr<TestObject> wp1(sp1);
+        std::weak_ptr<TestObject> wp2(sp2);
+        TestObject::deleted = false;
+        sp1.reset();
+        sp2.reset();
+        assert(TestObject::deleted);
+        assert(wp1.expired());
+        assert(wp2.expired());
+        //the weak pointers still hold the single allocation
+        assert(deallocations == 0);
+        assert(stdDeallocations == 0);
+    }
+    assert(deallocations == 1);
+    assert(stdDeallocations == 1);
+
+    //objects from a monotonic arena, with the arena passed on to allocator-aware members
+    unsigned char buffer[4096];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+    {
+        std::pmr::polymorphic_allocator<ArenaObject> alloc(&arena);
+        SharedPtr<ArenaObject> sp3 = AllocateShared<ArenaObject>(alloc, 530);
+        std::shared_ptr<ArenaObject> sp4 = std::allocate_shared<ArenaObject>(alloc, 530);
+        sp3->items.push_back(1);
+        sp4->items.push_back(1);
+        assert(sp3->items.get_allocator().resource() == &arena);
+        assert(sp4->items.get_allocator().resource() == &arena);
+        assert(reinterpret_cast<unsigned char*>(sp3.get()) >= buffer && reinterpret_cast<unsigned char*>(sp3.get()) < buffer + sizeof(buffer));
+        SharedPtr<ArenaObject> sp5(sp3);
+        assert(sp5.getCount() == 2);
+    }
+    std::cout << "testAllocateShared passed!" << std::endl;
+}
+
+void testAliasing() {
+    CountedObject::destroyed = 0;
+    SharedPtr<int> header;
+    std::shared_ptr<int> stdHeader;
+    {
+        SharedPtr<Buffer> sp1 = MakeShared<Buffer>(540);
+        std::shared_ptr<Buffer> sp2 = std::make_shared<Buffer>(540);
+        header = SharedPtr<int>(sp1, &sp1->header);
+        stdHeader = std::shared_ptr<int>(sp2, &sp2->header);
+        SharedPtr<int> slice(sp1, sp1->data + 10);
+        std::shared_ptr<int> stdSlice(sp2, sp2->data + 10);
+        assert(*header == 540);
+        assert(*stdHeader == 540);
+        assert(slice.get()[5] == 555);
+        assert(stdSlice.get()[5] == 555);
+        assert(sp1.getCount() == 3);
+        assert(sp2.use_count() == 3);
+    }
+    //the member handle alone keeps the whole buffer alive
+    assert(*header == 540);
+    assert(*stdHeader == 540);
+    assert(header.getCount() == 1);
+    assert(stdHeader.use_count() == 1);
+
+    //moving the owner in transfers its reference without an increment
+    SharedPtr<CountedObject> owner = MakeShared<CountedObject>(550);
+    CountedObject* object = owner.get();
+    SharedPtr<int> value(std::move(owner), &object->value);
+    assert(owner.get() == nullptr);
+    assert(value.getCount() == 1);
+    assert(*value == 550);
+    value.reset();
+    assert(CountedObject::destroyed == 1);
+
+    //aliasing an empty owner points without owning, like std::shared_ptr
+    int local = 560;
+    SharedPtr<int> unowned(SharedPtr<Buffer>(), &local);
+    std::shared_ptr<int> stdUnowned(std::shared_ptr<Buffer>(), &local);
+    assert(unowned.get() == &local);
+    assert(stdUnowned.get() == &local);
+    assert(unowned.getCount() == 0);
+    assert(stdUnowned.use_count() == 0);
+    std::cout << "testAliasing passed!" << std::endl;
+}
+
+void testPointerCasts() {
+    SharedPtr<Derived> sp1 = MakeShared<Derived>(570);
+    std::shared_ptr<Derived> sp2 = std::make_shared<Derived>(570);
+
+    //derived to base and to const share the block
+    SharedPtr<Base> base(sp1);
+    std::shared_ptr<Base> stdBase(sp2);
+    SharedPtr<const Derived> constDerived = sp1;
+    std::shared_ptr<const Derived> stdConstDerived = sp2;
+    assert(base.get() == sp1.get());
+    assert(stdBase.get() == sp2.get());
+    assert(sp1.getCount() == 3);
+    assert(sp2.use_count() == 3);
+
+    SharedPtr<Derived> down = StaticPointerCast<Derived>(base);
+    std::shared_ptr<Derived> stdDown = std::static_pointer_cast<Derived>(stdBase);
+    assert(down.get() == sp1.get());
+    assert(stdDown.get() == sp2.get());
+    assert(sp1.getCount() == 4);
+    assert(sp2.use_count() == 4);
+
+    SharedPtr<Derived> checked = DynamicPointerCast<Derived>(base);
+    std::shared_ptr<Derived> stdChecked = std::dynamic_pointer_cast<Derived>(stdBase);
+    assert(checked.get() == sp1.get());
+    assert(stdChecked.get() == sp2.get());
+    SharedPtr<Base> plain = MakeShared<Base>(580);
+    std::shared_ptr<Base> stdPlain = std::make_shared<Base>(580);
+    assert(DynamicPointerCast<Derived>(plain).get() == nullptr);
+    assert(std::dynamic_pointer_cast<Derived>(stdPlain).get() == nullptr);
+    assert(DynamicPointerCast<Derived>(plain).getCount() == 0);
+
+    SharedPtr<Derived> mutableDerived = ConstPointerCast<Derived>(constDerived);
+    std::shared_ptr<Derived> stdMutableDerived = std::const_pointer_cast<Derived>(stdConstDerived);
+    mutableDerived->value = 590;
+    stdMutableDerived->value = 590;
+    assert(sp1->value == 590);
+    assert(sp2->value == 590);
+    assert(sp1.getCount() == 6);
+    assert(sp2.use_count() == 6);
+
+    //rvalue casts hand the reference over, the count stays the same
+    SharedPtr<Base> movedBase = StaticPointerCast<Base>(std::move(down));
+    assert(down.get() == nullptr);
+    assert(sp1.getCount() == 6);
+    SharedPtr<Derived> failed = DynamicPointerCast<Derived>(std::move(plain));
+    assert(failed.get() == nullptr);
+    assert(plain.get() != nullptr);
+    assert(plain.getCount() == 1);
+    SharedPtr<Derived> movedChecked = DynamicPointerCast<Derived>(std::move(movedBase));
+    assert(movedBase.get() == nullptr);
+    assert(movedChecked.get() == sp1.get());
+    assert(sp1.getCount() == 6);
+    SharedPtr<Base> converted(std::move(movedChecked));
+    assert(movedChecked.get() == nullptr);
+    assert(sp1.getCount() == 6);
+    std::cout << "testPointerCasts passed!" << std::endl;
+}
+
+void testSharedArray() {
+    ArrayElement::constructed = 0;
+    ArrayElement::destroyed = 0;
+    {
+        //adopted arrays are released with delete[]
+        SharedPtr<ArrayElement[]> sp1(new ArrayElement[3], 3);
+        std::shared_ptr<ArrayElement[]> sp2(new ArrayElement[3]);
+        assert(sp1.size() == 3);
+        sp1[1].value = 600;
+        sp2[1].value = 600;
+        SharedPtr<ArrayElement[]> sp3 = sp1;
+        std::shared_ptr<ArrayElement[]> sp4 = sp2;
+        assert(sp3[1].value == 600);
+        assert(sp4[1].value == 600);
+        assert(sp3.size() == 3);
+        assert(sp1.getCount() == 2);
+        assert(sp2.use_count() == 2);
+    }
+    assert(ArrayElement::destroyed == 6);
+
+    {
+        SharedPtr<int[]> values = MakeSharedArray<int>(16);
+        assert(values.size() == 16);
+        assert(reinterpret_cast<std::uintptr_t>(values.get()) % 64 == 0);
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            //value-initialized
+            assert(values[i] == 0);
+            values[i] = static_cast<int>(i);
+        }
+        //length, elements and count survive copies, moves, const conversion and WeakPtr
+        SharedPtr<const int[]> view = values;
+        WeakPtr<int[]> observer(values);
+        SharedPtr<int[]> moved = std::move(values);
+        assert(values.get() == nullptr);
+        assert(view.size() == 16);
+        assert(view[15] == 15);
+        assert(moved.getCount() == 2);
+        SharedPtr<int[]> locked = observer.lock();
+        assert(locked.size() == 16);
+        assert(locked.get() == moved.get());
+        locked.reset();
+        assert(locked.get() == nullptr);
+        moved.reset();
+        view.reset();
+        assert(observer.expired());
+        assert(observer.lock().get() == nullptr);
+    }
+
+    ArrayElement::constructed = 0;
+    ArrayElement::destroyed = 0;
+    {
+        SharedPtr<ArrayElement[]> elements = MakeSharedArray<ArrayElement>(5);
+        assert(ArrayElement::constructed == 5);
+        assert(elements[4].value == 7);
+    }
+    assert(ArrayElement::destroyed == 5);
+    std::cout << "testSharedArray passed!" << std::endl;
+}
+
+void testMakeSharedForOverwrite() {
+    SharedPtr<double[]> samples = MakeSharedForOverwrite<double>(1000);
+    assert(samples.size() == 1000);
+    assert(reinterpret_cast<std::uintptr_t>(samples.get()) % 64 == 0);
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = 0.5 * i;
+    }
+    assert(samples[999] == 499.5);
+
+    //larger and smaller alignments, the smaller one is raised to the element's own
+    SharedPtr<float[]> page = MakeSharedArray<float>(3, 4096);
+    assert(reinterpret_cast<std::uintptr_t>(page.get()) % 4096 == 0);
+    SharedPtr<std::uint64_t[]> words = MakeSharedArray<std::uint64_t>(3, 1);
+    assert(reinterpret_cast<std::uintptr_t>(words.get()) % alignof(std::uint64_t) == 0);
+    SharedPtr<int[]> none = MakeSharedArray<int>(0);
+    assert(none.size() == 0);
+    assert(none.getCount() == 1);
+
+    bool rejected = false;
+    try {
+        MakeSharedArray<int>(4, 48);
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    assert(rejected);
+
+    //class types are still default constructed
+    ArrayElement::constructed = 0;
+    ArrayElement::destroyed = 0;
+    SharedPtr<ArrayElement[]> elements = MakeSharedForOverwrite<ArrayElement>(4);
+    assert(ArrayElement::constructed == 4);
+    elements.reset();
+    assert(ArrayElement::destroyed == 4);
+
+    //a throwing element constructor unwinds the elements built so far
+    ArrayElement::constructed = 0;
+    ArrayElement::destroyed = 0;
+    ArrayElement::throwAt = 3;
+    bool threw = false;
+    try {
+        MakeSharedArray<ArrayElement>(8);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    ArrayElement::throwAt = -1;
+    assert(threw);
+    assert(ArrayElement::constructed == 3);
+    assert(ArrayElement::destroyed == 3);
+    std::cout << "testMakeSharedForOverwrite passed!" << std::endl;
+}
+
+void testIntrusive() {
+    typedef SharedPtr<IntrusiveNode, Intrusive<>> NodePtr;
+    static_assert(sizeof(NodePtr) == sizeof(void*), "an intrusive handle is a single pointer");
+    IntrusiveNode::destroyed = 0;
+    {
+        NodePtr sp1 = MakeShared<IntrusiveNode, Intrusive<>>(610);
+        NodePtr sp2 = sp1;
+        assert(sp1.getCount() == 2);
+        assert(sp2->value == 610);
+        //the count is in the object, so a raw pointer can become an owner again
+        NodePtr sp3(sp1.get());
+        NodePtr sp4 = sp1->SharedFromThis();
+        assert(sp1.getCount() == 4);
+        NodePtr moved = std::move(sp2);
+        assert(sp2.get() == nullptr);
+        assert(sp1.getCount() == 4);
+        sp3.reset();
+        sp4.reset(new IntrusiveNode(620));
+        assert(sp1.getCount() == 2);
+        assert(sp4.getCount() == 1);
+        sp4 = sp1;
+        assert(IntrusiveNode::destroyed == 1);
+        assert(sp1.getCount() == 3);
+    }
+    assert(IntrusiveNode::destroyed == 2);
+
+    //a chain of nodes goes away with its head
+    IntrusiveNode::destroyed = 0;
+    {
+        NodePtr head = MakeShared<IntrusiveNode, Intrusive<>>(0);
+        IntrusiveNode* tail = head.get();
+        for (int i = 1; i < 100; ++i) {
+            tail->next = MakeShared<IntrusiveNode, Intrusive<>>(i);
+            tail = tail->next.get();
+        }
+        assert(tail->value == 99);
+        //each step releases the node that owns the handle being read
+        for (int i = 1; i < 50; ++i) {
+            head = head->next;
+            assert(head->value == i);
+        }
+        for (int i = 50; i < 100; ++i) {
+            head = std::move(head->next);
+            assert(head->value == i);
+        }
+        assert(IntrusiveNode::destroyed == 99);
+    }
+    assert(IntrusiveNode::destroyed == 100);
+
+    //casts and conversions reuse the object's own count
+    IntrusiveNode::destroyed = 0;
+    {
+        SharedPtr<IntrusiveLeaf, Intrusive<>> leaf = MakeShared<IntrusiveLeaf, Intrusive<>>(630);
+        NodePtr node = leaf;
+        SharedPtr<const IntrusiveNode, Intrusive<>> constNode = node;
+        assert(leaf.getCount() == 3);
+        SharedPtr<IntrusiveLeaf, Intrusive<>> down = DynamicPointerCast<IntrusiveLeaf>(node);
+        assert(down.get() == leaf.get());
+        NodePtr plain = MakeShared<IntrusiveNode, Intrusive<>>(640);
+        assert(DynamicPointerCast<IntrusiveLeaf>(plain).get() == nullptr);
+        NodePtr up = StaticPointerCast<IntrusiveNode>(std::move(down));
+        assert(down.get() == nullptr);
+        assert(leaf.getCount() == 4);
+        NodePtr mutableNode = ConstPointerCast<IntrusiveNode>(constNode);
+        assert(leaf.getCount() == 5);
+    }
+    assert(IntrusiveNode::destroyed == 2);
+
+    //threads copying the same object free it exactly once
+    IntrusiveNode::destroyed = 0;
+    {
+        NodePtr shared = MakeShared<IntrusiveNode, Intrusive<>>(650);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; ++i) {
+            threads.emplace_back([shared]() {
+                for (int j = 0; j < 1000; ++j) {
+                    NodePtr copy(shared);
+                    NodePtr self = copy->SharedFromThis();
+                    assert(self->value == 650);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(shared.getCount() == 1);
+    }
+    assert(IntrusiveNode::destroyed == 1);
+
+    SharedPtr<LocalNode, Intrusive<SingleThreaded>> local = MakeShared<LocalNode, Intrusive<SingleThreaded>>(660);
+    SharedPtr<LocalNode, Intrusive<SingleThreaded>> localCopy = local;
+    assert(local.getCount() == 2);
+    assert(localCopy->value == 660);
+    std::cout << "testIntrusive passed!" << std::endl;
+}
+
+void testEnableSharedFromThis() {
+    SharedPtr<Session> sp1 = MakeShared<Session>(670);
+    std::shared_ptr<StdSession> sp2 = std::make_shared<StdSession>(670);
+    SharedPtr<Session> self1 = sp1->SharedFromThis();
+    std::shared_ptr<StdSession> self2 = sp2->shared_from_this();
+    assert(self1.get() == sp1.get());
+    assert(self2.get() == sp2.get());
+    assert(sp1.getCount() == 2);
+    assert(sp2.use_count() == 2);
+    const Session& constSession = *sp1;
+    SharedPtr<const Session> constSelf = constSession.SharedFromThis();
+    assert(constSelf->id == 670);
+    assert(sp1.getCount() == 3);
+
+    //adopted objects and objects with a deleter or allocator are hooked up too
+    SharedPtr<Session> adopted(new Session(680));
+    assert(adopted->SharedFromThis().getCount() == 2);
+    SharedPtr<Session> deleted(new Session(690), [](Session* session) { delete session; });
+    assert(deleted->SharedFromThis().get() == deleted.get());
+    SharedPtr<Session> allocated = AllocateShared<Session>(std::allocator<Session>(), 700);
+    assert(allocated->SharedFromThis().get() == allocated.get());
+    SharedPtr<Session> reset;
+    reset.reset(new Session(710));
+    assert(reset->SharedFromThis().getCount() == 2);
+
+    //an object nobody owns throws, and so does a copy of an owned object
+    Session unowned(720);
+    StdSession stdUnowned(720);
+    bool threw = false;
+    try {
+        unowned.SharedFromThis();
+    } catch (const std::bad_weak_ptr&) {
+        threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try {
+        stdUnowned.shared_from_this();
+    } catch (const std::bad_weak_ptr&) {
+        threw = true;
+    }
+    assert(threw);
+    Session copied(*sp1);
+    threw = false;
+    try {
+        copied.SharedFromThis();
+    } catch (const std::bad_weak_ptr&) {
+        threw = true;
+    }
+    assert(threw);
+
+    //the object's own WeakPtr does not keep it alive
+    WeakPtr<Session> observer = sp1->WeakFromThis();
+    std::weak_ptr<StdSession> stdObserver = sp2->weak_from_this();
+    assert(!observer.expired());
+    sp1.reset();
+    self1.reset();
+    constSelf.reset();
+    sp2.reset();
+    self2.reset();
+    assert(observer.expired());
+    assert(stdObserver.expired());
+
+    SharedPtr<LocalSession, SingleThreaded> local = MakeShared<LocalSession, SingleThreaded>(730);
+    assert(local->SharedFromThis().getCount() == 2);
+    std::cout << "testEnableSharedFromThis passed!" << std::endl;
+}
+
+void testCompactSharedPtr() {
+    static_assert(sizeof(CompactSharedPtr<TestObject>) == sizeof(void*), "a compact handle is a single pointer");
+    CountedObject::destroyed = 0;
+    {
+        CompactSharedPtr<CountedObject> cp1 = MakeCompactShared<CountedObject>(740);
+        CompactSharedPtr<CountedObject> cp2 = cp1;
+        assert(cp1.getCount() == 2);
+        assert(cp2->value == 740);
+        assert(cp2.get() == cp1.get());
+        CompactSharedPtr<CountedObject> cp3 = std::move(cp2);
+        assert(cp2.get() == nullptr);
+        assert(cp2.getCount() == 0);
+        assert(cp1.getCount() == 2);
+
+        //each conversion is one increment when copying and none when moving
+        SharedPtr<CountedObject> sp1 = cp1.toShared();
+        assert(sp1.get() == cp1.get());
+        assert(sp1.getCount() == 3);
+        SharedPtr<CountedObject> sp2 = std::move(cp3).toShared();
+        assert(cp3.get() == nullptr);
+        assert(sp1.getCount() == 3);
+        CompactSharedPtr<CountedObject> cp4(sp2);
+        assert(sp1.getCount() == 4);
+        CompactSharedPtr<CountedObject> cp5(std::move(sp2));
+        assert(sp2.get() == nullptr);
+        assert(sp1.getCount() == 4);
+        WeakPtr<CountedObject> observer(sp1);
+        cp1.reset();
+        cp4.reset();
+        cp5 = nullptr;
+        sp1.reset();
+        assert(observer.expired());
+        assert(CountedObject::destroyed == 1);
+    }
+
+    //objects from outside MakeShared, or aliased handles, are somewhere only their block knows
+    SharedPtr<CountedObject> adopted(new CountedObject(750));
+    SharedPtr<CountedObject> made = MakeShared<CountedObject>(760);
+    SharedPtr<int> member(made, &made->value);
+    assert(!CompactSharedPtr<CountedObject>::canHold(adopted));
+    assert(CompactSharedPtr<CountedObject>::canHold(made));
+    assert(CompactSharedPtr<CountedObject>::canHold(SharedPtr<CountedObject>()));
+    bool rejected = false;
+    try {
+        CompactSharedPtr<CountedObject> compact(std::move(adopted));
+    } catch (const std::invalid_argument&) {
+        rejected = true;
+    }
+    assert(rejected);
+    assert(adopted.getCount() == 1);
+    CompactSharedPtr<CountedObject> empty{SharedPtr<CountedObject>()};
+    assert(empty.get() == nullptr);
+
+    //assigning from the handle inside the node the assignment releases
+    CompactNode::destroyed = 0;
+    {
+        CompactSharedPtr<CompactNode> head = MakeCompactShared<CompactNode>(0);
+        CompactNode* tail = head.get();
+        for (int i = 1; i < 10; ++i) {
+            tail->next = MakeCompactShared<CompactNode>(i);
+            tail = tail->next.get();
+        }
+        for (int i = 1; i < 5; ++i) {
+            head = head->next;
+            assert(head->value == i);
+        }
+        for (int i = 5; i < 10; ++i) {
+            head = std::move(head->next);
+            assert(head->value == i);
+        }
+        assert(CompactNode::destroyed == 9);
+    }
+    assert(CompactNode::destroyed == 10);
+
+    //a handle array at half the footprint
+    const int numObjects = 10000;
+    std::vector<CompactSharedPtr<TestObject>> compactArray(numObjects);
+    for (int i = 0; i < numObjects; ++i) {
+        compactArray[i] = MakeCompactShared<TestObject>(i);
+    }
+    long sum = 0;
+    for (const CompactSharedPtr<TestObject>& cp : compactArray) {
+        sum += cp->value;
+    }
+    assert(sum == static_cast<long>(numObjects) * (numObjects - 1) / 2);
+    std::cout << "testCompactSharedPtr passed!" << std::endl;
+}
+
+//helpers that only look at the object, and one that keeps it
+int readValue(Borrowed<CountedObject> object) {
+    return object->value;
+}
+
+int readThroughChain(Borrowed<CountedObject> object, int depth) {
+    return depth == 0 ? readValue(object) : readThroughChain(object, depth - 1);
+}
+
+SharedPtr<CountedObject> keepValue(Borrowed<CountedObject> object) {
+    return object.toShared();
+}
+
+int readBase(Borrowed<Base> object) {
+    return object->value;
+}
+
+void testBorrowed() {
+    CountedObject::destroyed = 0;
+    {
+        SharedPtr<CountedObject> sp1 = MakeShared<CountedObject>(770);
+        SharedPtr<CountedObject> kept;
+        {
+            //borrowing and passing the view around leaves the count alone
+            assert(readValue(sp1) == 770);
+            assert(readThroughChain(sp1, 10) == 770);
+            Borrowed<CountedObject> view = sp1;
+            Borrowed<CountedObject> copy = view;
+            assert(copy.get() == sp1.get());
+            assert((*copy).value == 770);
+            assert(sp1.getCount() == 1);
+
+            //promotion is one increment and shares the owners' block
+            kept = keepValue(view);
+            assert(kept.get() == sp1.get());
+            assert(sp1.getCount() == 2);
+        }
+        WeakPtr<CountedObject> observer(kept);
+        sp1.reset();
+        assert(kept->value == 770);
+        kept.reset();
+        assert(observer.expired());
+        assert(CountedObject::destroyed == 1);
+    }
+
+    //views convert like the handles they come from
+    SharedPtr<Derived> derived = MakeShared<Derived>(780);
+    assert(readBase(derived) == 780);
+    Borrowed<Derived> derivedView = derived;
+    Borrowed<Base> baseView = derivedView;
+    assert(baseView.toShared().getCount() == 2);
+    assert(derived.getCount() == 1);
+
+    SharedPtr<CountedObject> none;
+    Borrowed<CountedObject> fromEmpty = none;
+    assert(fromEmpty.get() == nullptr);
+    assert(fromEmpty.toShared().get() == nullptr);
+    std::cout << "testBorrowed passed!" << std::endl;
+}
+
+void testReleaseBatching() {
+    CountedObject::destroyed = 0;
+    {
+        ScopedReleaseBatching batching;
+        SharedPtr<BatchedObject> sp1 = MakeShared<BatchedObject>(790);
+        {
+            std::vector<SharedPtr<BatchedObject>> copies(100, sp1);
+            assert(sp1.getCount() == 101);
+        }
+        //the hundred releases are waiting in the buffer
+        assert(sp1.getCount() == 101);
+        flushReleases();
+        assert(sp1.getCount() == 1);
+
+        //the last owner's release waits too, the object stays alive until the buffer is applied
+        WeakPtr<BatchedObject> observer(sp1);
+        sp1.reset();
+        assert(!observer.expired());
+        assert(CountedObject::destroyed == 0);
+        flushReleases();
+        assert(observer.expired());
+        assert(CountedObject::destroyed == 1);
+
+        //other types are not batched
+        SharedPtr<CountedObject> plain = MakeShared<CountedObject>(800);
+        plain.reset();
+        assert(CountedObject::destroyed == 2);
+    }
+
+    //releases made by destructors while the buffer is applied are batched and applied too, ending the scope applies everything
+    CountedObject::destroyed = 0;
+    WeakPtr<BatchedObject> tailObserver;
+    {
+        ScopedReleaseBatching batching;
+        SharedPtr<BatchedObject> head = MakeShared<BatchedObject>(0);
+        BatchedObject* tail = head.get();
+        for (int i = 1; i < 1000; ++i) {
+            tail->next = MakeShared<BatchedObject>(i);
+            tail = tail->next.get();
+        }
+        tailObserver = tail->next = MakeShared<BatchedObject>(1000);
+        //repeated releases of one block take a single entry
+        std::vector<SharedPtr<BatchedObject>> copies(5000, head);
+        copies.clear();
+        assert(head.getCount() == 5001);
+        //releases of more blocks than the buffer holds make it apply itself
+        std::vector<SharedPtr<BatchedObject>> objects;
+        for (int i = 0; i < 1000; ++i) {
+            objects.push_back(MakeShared<BatchedObject>(i));
+        }
+        std::vector<SharedPtr<BatchedObject>> objectCopies = objects;
+        objectCopies.clear();
+        assert(objects.front().getCount() == 1);
+        assert(objects.back().getCount() == 2);
+        objects.clear();
+        assert(CountedObject::destroyed < 1000);
+    }
+    assert(tailObserver.expired());
+    assert(CountedObject::destroyed == 2001);
+
+    //without a scope every release is immediate
+    SharedPtr<BatchedObject> unbatched = MakeShared<BatchedObject>(810);
+    SharedPtr<BatchedObject> unbatchedCopy = unbatched;
+    unbatchedCopy.reset();
+    assert(unbatched.getCount() == 1);
+
+    //threads batch independently
+    CountedObject::destroyed = 0;
+    SharedPtr<BatchedObject> shared = MakeShared<BatchedObject>(820);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([shared]() {
+            ScopedReleaseBatching batching;
+            for (int j = 0; j < 1000; ++j) {
+                SharedPtr<BatchedObject> copy(shared);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(shared.getCount() == 1);
+    shared.reset();
+    assert(CountedObject::destroyed == 1);
+    std::cout << "testReleaseBatching passed!" << std::endl;
+}
+
+void testSharedPtrQueue() {
+    CountedObject::destroyed = 0;
+    {
+        SharedPtrQueue<CountedObject> queue(4);
+        assert(queue.capacity() == 4);
+        SharedPtr<CountedObject> out;
+        assert(!queue.pop(out));
+
+        //items move through without touching their counts
+        SharedPtr<CountedObject> sp1 = MakeShared<CountedObject>(790);
+        SharedPtr<CountedObject> kept(sp1);
+        assert(queue.push(std::move(sp1)));
+        assert(sp1.get() == nullptr);
+        assert(kept.getCount() == 2);
+        assert(queue.pop(out));
+        assert(out.get() == kept.get());
+        assert(kept.getCount() == 2);
+
+        //a full queue refuses pushes and leaves the item with the caller
+        for (int i = 0; i < 4; ++i) {
+            assert(queue.push(MakeShared<CountedObject>(i)));
+        }
+        SharedPtr<CountedObject> extra = MakeShared<CountedObject>(4);
+        assert(!queue.push(std::move(extra)));
+        assert(extra->value == 4);
+        assert(queue.approximateSize() == 4);
+
+        //bulk pops come out oldest first, a bulk push takes what fits
+        SharedPtr<CountedObject> batch[3];
+        assert(queue.popBulk(batch, 3) == 3);
+        assert(batch[0]->value == 0 && batch[2]->value == 2);
+        assert(queue.pushBulk(batch, 3) == 3);
+        assert(batch[0].get() == nullptr);
+        SharedPtr<CountedObject> more[2] = {std::move(extra), MakeShared<CountedObject>(5)};
+        assert(queue.pushBulk(more, 2) == 0);
+        assert(more[0]->value == 4);
+        assert(queue.popBulk(batch, 3) == 3);
+        assert(batch[0]->value == 3 && batch[1]->value == 0);
+
+        //empty handles go through as empty handles
+        assert(queue.push(SharedPtr<CountedObject>()));
+        assert(CountedObject::destroyed == 0);
+    }
+    //destroying the queue released the item still in it and the handles above
+    assert(CountedObject::destroyed == 7);
+
+    bool threw = false;
+    try {
+        SharedPtrQueue<CountedObject> odd(3);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    //producers and consumers on several threads, every item arrives exactly once
+    CountedObject::destroyed = 0;
+    const int numProducers = 4;
+    const int itemsPerProducer = 5000;
+    SharedPtrQueue<CountedObject> queue(64);
+    std::atomic<long> sum(0);
+    std::atomic<int> received(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < numProducers; ++p) {
+        threads.emplace_back([&queue, p]() {
+            for (int i = 0; i < itemsPerProducer; ++i) {
+                SharedPtr<CountedObject> item = MakeShared<CountedObject>(p * itemsPerProducer + i);
+                while (!queue.push(std::move(item))) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < numProducers; ++c) {
+        threads.emplace_back([&queue, &sum, &received]() {
+            SharedPtr<CountedObject> items[8];
+            while (received.load() < numProducers * itemsPerProducer) {
+                std::size_t popped = queue.popBulk(items, 8);
+                for (std::size_t i = 0; i < popped; ++i) {
+                    assert(items[i].getCount() == 1);
+                    sum += items[i]->value;
+                    items[i].reset();
+                }
+                received += static_cast<int>(popped);
+                if (popped == 0) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    long total = numProducers * itemsPerProducer;
+    assert(sum == total * (total - 1) / 2);
+    assert(CountedObject::destroyed == total);
+    std::cout << "testSharedPtrQueue passed!" << std::endl;
+}
+
+//a cache key that looks into the cache it is used with when it goes away, which deadlocks under the shard lock
+struct ProbingKey {
+    int id;
+
+    struct Hash {
+        std::size_t operator()(const ProbingKey& key) const {
+            return std::hash<int>()(key.id);
+        }
+    };
+
+    static SharedCache<ProbingKey, CountedObject, Hash>* cache;
+    static int probes;
+
+    ProbingKey(int id) : id(id) {}
+
+    ProbingKey(const ProbingKey&) = default;
+
+    ~ProbingKey() {
+        if (cache != nullptr) {
+            cache->size();
+            ++probes;
+        }
+    }
+
+    bool operator==(const ProbingKey& other) const {
+        return this->id == other.id;
+    }
+};
+
+SharedCache<ProbingKey, CountedObject, ProbingKey::Hash>* ProbingKey::cache = nullptr;
+int ProbingKey::probes = 0;
+
+void testSharedCache() {
+    CountedObject::destroyed = 0;
+    {
+        //one shard with room for two values
+        SharedCache<int, CountedObject> cache(2, 1);
+        int loads = 0;
+        auto load = [&loads](int value) {
+            return [&loads, value]() {
+                ++loads;
+                return MakeShared<CountedObject>(value);
+            };
+        };
+        SharedPtr<CountedObject> first = cache.getOrCreate(1, load(1));
+        assert(first->value == 1);
+        assert(cache.getOrCreate(1, load(100)).get() == first.get());
+        assert(loads == 1);
+        assert(first.getCount() == 2);
+        assert(cache.get(5).get() == nullptr);
+
+        //going over the budget demotes the idle 2, used values get another round
+        cache.getOrCreate(2, load(2));
+        SharedPtr<CountedObject> third = cache.getOrCreate(3, load(3));
+        assert(cache.stats().demotions == 1);
+        assert(first.getCount() == 2);
+        assert(CountedObject::destroyed == 1);
+        //a demoted value lives on while someone holds it
+        cache.getOrCreate(4, load(4));
+        assert(third.getCount() == 1);
+        assert(CountedObject::destroyed == 1);
+        //and comes back without a load, which in turn demotes 1, idle since the hand last passed it
+        assert(cache.get(3).get() == third.get());
+        assert(third.getCount() == 2);
+        assert(cache.stats().revivals == 1);
+        assert(first.getCount() == 1);
+        assert(CountedObject::destroyed == 1);
+        //2 has to be loaded again
+        assert(cache.getOrCreate(2, load(2))->value == 2);
+        assert(loads == 5);
+        SharedCache<int, CountedObject>::Stats stats = cache.stats();
+        assert(stats.hits == 2);
+        assert(stats.misses == 6);
+        assert(stats.coalesced == 0);
+
+        //demoted entries whose object is gone are evicted as the hand passes them
+        for (int i = 10; i < 20; ++i) {
+            cache.getOrCreate(i, load(i));
+        }
+        assert(cache.stats().evictions > 0);
+        assert(cache.size() < 13);
+
+        //a failing factory leaves nothing behind and the next caller loads again
+        bool threw = false;
+        try {
+            cache.getOrCreate(30, []() -> SharedPtr<CountedObject> { throw std::runtime_error("load failed"); });
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        assert(cache.getOrCreate(30, load(30))->value == 30);
+
+        //empty results are handed back but not cached
+        assert(cache.getOrCreate(40, []() { return SharedPtr<CountedObject>(); }).get() == nullptr);
+        assert(cache.get(40).get() == nullptr);
+        cache.erase(30);
+        assert(cache.get(30).get() == nullptr);
+    }
+
+    //entries leave the index under the shard lock but are destroyed after it, so their keys may use the cache
+    {
+        SharedCache<ProbingKey, CountedObject, ProbingKey::Hash> cache(1, 1);
+        ProbingKey::cache = &cache;
+        //demoted and then evicted by the hand
+        for (int i = 0; i < 8; ++i) {
+            cache.getOrCreate(i, [i]() { return MakeShared<CountedObject>(i); });
+        }
+        assert(cache.stats().evictions > 0);
+        //erased
+        cache.erase(7);
+        //a failed load and an empty one
+        try {
+            cache.getOrCreate(20, []() -> SharedPtr<CountedObject> { throw std::runtime_error("load failed"); });
+        } catch (const std::runtime_error&) {
+        }
+        cache.getOrCreate(21, []() { return SharedPtr<CountedObject>(); });
+        assert(ProbingKey::probes > 0);
+        ProbingKey::cache = nullptr;
+    }
+
+    //threads asking for the same missing key share one load
+    SharedCache<int, CountedObject> cache(64);
+    std::atomic<int> loads(0);
+    std::vector<SharedPtr<CountedObject>> results(8);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 8; ++i) {
+        threads.emplace_back([&cache, &loads, &results, i]() {
+            results[i] = cache.getOrCreate(42, [&loads]() {
+                ++loads;
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                return MakeShared<CountedObject>(42);
+            });
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(loads == 1);
+    for (const SharedPtr<CountedObject>& result : results) {
+        assert(result.get() == results[0].get());
+    }
+    SharedCache<int, CountedObject>::Stats stats = cache.stats();
+    assert(stats.misses == 1 && stats.hits == 7);
+    std::cout << "testSharedCache passed!" << std::endl;
+}
+
+void testSnapshotPublisher() {
+    CountedObject::destroyed = 0;
+    {
+        SnapshotPublisher<CountedObject> publisher(MakeShared<CountedObject>(800));
+        assert(publisher.version() == 1);
+        //repeated reads hand back the thread's cached handle without touching the count
+        const SharedPtr<CountedObject>& first = publisher.read();
+        assert(first->value == 800);
+        assert(&publisher.read() == &first);
+        assert(first.getCount() == 2);
+
+        //a publish is picked up by the next read, and the old snapshot goes once this thread has moved on
+        publisher.publish(MakeShared<CountedObject>(801));
+        assert(publisher.version() == 2);
+        assert(CountedObject::destroyed == 0);
+        assert(publisher.read()->value == 801);
+        assert(CountedObject::destroyed == 1);
+        assert(publisher.load()->value == 801);
+
+        //several publishers of one type are cached side by side
+        SnapshotPublisher<CountedObject> other(MakeShared<CountedObject>(900));
+        assert(other.read()->value == 900);
+        assert(publisher.read()->value == 801);
+        SnapshotPublisher<CountedObject> empty;
+        assert(empty.read().get() == nullptr);
+
+        //readers on other threads keep the snapshot they cached until they read again
+        std::mutex mtx;
+        std::condition_variable cv;
+        int step = 0;
+        std::thread reader([&]() {
+            assert(publisher.read()->value == 801);
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                step = 1;
+                cv.notify_all();
+                cv.wait(lock, [&step] { return step == 2; });
+            }
+            assert(publisher.read()->value == 802);
+        });
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&step] { return step == 1; });
+            publisher.publish(MakeShared<CountedObject>(802));
+            assert(publisher.read()->value == 802);
+            //801 is still cached by the other thread
+            assert(CountedObject::destroyed == 1);
+            step = 2;
+            cv.notify_all();
+        }
+        reader.join();
+        assert(CountedObject::destroyed == 2);
+    }
+    //the destroyed publishers' snapshots are still cached by this thread until its next read adds or refreshes a snapshot
+    assert(CountedObject::destroyed == 2);
+    SnapshotPublisher<CountedObject> later(MakeShared<CountedObject>(803));
+    assert(later.read()->value == 803);
+    assert(CountedObject::destroyed == 4);
+
+    //many readers while a writer publishes, every read sees a live snapshot
+    std::atomic<bool> done(false);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&later, &done]() {
+            int last = 0;
+            while (!done.load()) {
+                int value = later.read()->value;
+                assert(value >= last);
+                last = value;
+            }
+        });
+    }
+    for (int i = 804; i < 1804; ++i) {
+        later.publish(MakeShared<CountedObject>(i));
+    }
+    done = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    assert(later.read()->value == 1803);
+    assert(CountedObject::destroyed == 1004);
+    std::cout << "testSnapshotPublisher passed!" << std::endl;
+}
+
+void testRecyclingPool() {
+    PooledFrame::constructed = 0;
+    PooledFrame::destroyed = 0;
+    SharedPtr<PooledFrame> survivor;
+    {
+        RecyclingPool<PooledFrame, ClearFrame> pool(2);
+        assert(pool.capacity() == 2);
+        PooledFrame* address = nullptr;
+        {
+            SharedPtr<PooledFrame> frame = pool.acquire();
+            assert(frame.getCount() == 1);
+            frame->data.assign(1000, 7);
+            address = frame.get();
+        }
+        //the last release reset the frame and put it back instead of destroying it
+        assert(pool.idle() == 1);
+        assert(PooledFrame::destroyed == 0);
+        SharedPtr<PooledFrame> reused = pool.acquire();
+        assert(reused.get() == address);
+        assert(reused->data.empty() && reused->data.capacity() >= 1000);
+        assert(reused.getCount() == 1);
+        assert(PooledFrame::constructed == 1);
+
+        //an observer keeps the frame out of the pool, but cannot revive it
+        WeakPtr<PooledFrame> observer(reused);
+        reused.reset();
+        assert(observer.expired());
+        assert(observer.lock().get() == nullptr);
+        assert(pool.idle() == 0);
+        observer.reset();
+        assert(pool.idle() == 1);
+
+        //frames coming back to a full pool are destroyed, trim gives the rest back
+        SharedPtr<PooledFrame> frames[3] = {pool.acquire(), pool.acquire(), pool.acquire()};
+        assert(PooledFrame::constructed == 3);
+        for (SharedPtr<PooledFrame>& frame : frames) {
+            frame.reset();
+        }
+        assert(pool.idle() == 2);
+        assert(PooledFrame::destroyed == 1);
+        pool.trim(1);
+        assert(pool.idle() == 1);
+        assert(PooledFrame::destroyed == 2);
+
+        //handles may outlive their pool, reused comes back first and is destroyed with the pool
+        survivor = pool.acquire();
+        assert(pool.idle() == 0);
+        reused = pool.acquire();
+        assert(PooledFrame::constructed == 4);
+    }
+    assert(PooledFrame::destroyed == 3);
+    survivor.reset();
+    assert(PooledFrame::destroyed == 4);
+    assert(PooledFrame::constructed == 4);
+
+    bool threw = false;
+    try {
+        RecyclingPool<PooledFrame> odd(3);
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+
+    //threads acquire and release frames from one pool, handing some of them to each other
+    PooledFrame::constructed = 0;
+    PooledFrame::destroyed = 0;
+    {
+        RecyclingPool<PooledFrame, ClearFrame> pool(64);
+        SharedPtrQueue<PooledFrame> handoff(16);
+        const int numThreads = 4;
+        const int acquiresPerThread = 5000;
+        //a recycled frame keeps the capacity its cleared vector had, only a newly built one has none
+        std::atomic<int> misses(0);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < numThreads; ++i) {
+            threads.emplace_back([&pool, &handoff, &misses, i]() {
+                int built = 0;
+                for (int j = 0; j < acquiresPerThread; ++j) {
+                    SharedPtr<PooledFrame> frame = pool.acquire();
+                    assert(frame->data.empty());
+                    built += frame->data.capacity() == 0;
+                    frame->data.push_back(i);
+                    if (j % 4 == 0) {
+                        handoff.push(std::move(frame));
+                    }
+                    SharedPtr<PooledFrame> received;
+                    handoff.pop(received);
+                }
+                misses += built;
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        int built = PooledFrame::constructed;
+        assert(misses == built);
+        /* Without preemption only the frames out of the pool at once are ever built: two per thread and the handoff
+        * queue's. A thread preempted in the middle of giving a frame back hides the idle frames behind it and the others
+        * build new ones until it runs again, so the bound leaves room for that, but most acquires must still reuse.
+        * Under ThreadSanitizer that window is wide enough to hide them for thousands of acquires.
+        */
+        assert(TESTS_UNDER_TSAN || built <= numThreads * acquiresPerThread / 2);
+        //once the threads are done the pool serves acquires without building any
+        assert(pool.idle() > 0);
+        SharedPtr<PooledFrame> frame = pool.acquire();
+        assert(PooledFrame::constructed == built);
+    }
+    assert(PooledFrame::destroyed == PooledFrame::constructed);
+    std::cout << "testRecyclingPool passed!" << std::endl;
+}
+
+void testGraphSerializer() {
+    //two roots over a diamond: both roots point at top, whose children share bottom
+    SharedPtr<GraphNode> bottom = MakeShared<GraphNode>(4, "bottom");
+    SharedPtr<GraphNode> top = MakeShared<GraphNode>(1, "top");
+    top->left = MakeShared<GraphNode>(2, "left");
+    top->right = MakeShared<GraphNode>(3, "right");
+    top->left->left = bottom;
+    top->right->right = bottom;
+    top->right->left = bottom;
+    std::vector<SharedPtr<GraphNode>> roots = {top, top, SharedPtr<GraphNode>()};
+    bottom.reset();
+
+    std::ostringstream out;
+    {
+        GraphWriter<GraphNode> writer(out);
+        for (const SharedPtr<GraphNode>& root : roots) {
+            writer.writeRoot(root);
+        }
+        writer.finish();
+        assert(writer.nodes() == 4);
+    }
+    std::string bytes = out.str();
+    //header, then per node a record byte, 4 value bytes, label and two child ids, then the roots and the end
+    assert(bytes.size() == 8 + 4 * 8 + 6 + 4 + 5 + 3 + 2 + 2 + 2 + 1);
+
+    std::vector<SharedPtr<GraphNode>> loaded = loadGraph<GraphNode>(bytes.data(), bytes.size());
+    assert(loaded.size() == 3);
+    assert(loaded[0].get() == loaded[1].get() && loaded[0].get() != top.get());
+    assert(loaded[2].get() == nullptr);
+    SharedPtr<GraphNode> loadedTop = loaded[0];
+    assert(loadedTop->value == 1 && loadedTop->label == "top");
+    assert(loadedTop->left->label == "left" && loadedTop->right->value == 3);
+    assert(loadedTop->left->left.get() == loadedTop->right->right.get());
+    assert(loadedTop->right->left.get() == loadedTop->right->right.get());
+    assert(loadedTop->left->left->label == "bottom");
+    assert(loadedTop->left->right.get() == nullptr);
+    //the counts match the originals: the two roots plus the local copy, three parents for bottom
+    assert(loadedTop.getCount() == 3 && top.getCount() == 3);
+    assert(loadedTop->left->left.getCount() == 3 && top->left->left.getCount() == 3);
+    assert(loadedTop->left.getCount() == 1);
+
+    //the same graph through a memory mapped file
+    const char* path = "testGraphSerializer.graph";
+    {
+        std::ofstream file(path, std::ios::binary);
+        saveGraph(file, roots);
+    }
+    {
+        MappedFile mapped(path);
+        assert(mapped.size() == bytes.size());
+        assert(std::string(mapped.data(), mapped.size()) == bytes);
+    }
+    std::vector<SharedPtr<GraphNode>> fromFile = loadGraphFile<GraphNode>(path);
+    std::remove(path);
+    assert(fromFile.size() == 3 && fromFile[0].get() == fromFile[1].get());
+    assert(fromFile[0]->left->left.get() == fromFile[0]->right->left.get());
+    assert(fromFile[0]->left->left.getCount() == 3);
+
+    //a long chain is written and read without recursion
+    const int length = 100000;
+    SharedPtr<GraphNode> chain = MakeShared<GraphNode>(0, "");
+    for (int i = 1; i < length; ++i) {
+        SharedPtr<GraphNode> next = MakeShared<GraphNode>(i, "");
+        next->left = std::move(chain);
+        chain = std::move(next);
+    }
+    std::ostringstream chainOut;
+    saveGraph(chainOut, std::vector<SharedPtr<GraphNode>>{chain});
+    std::string chainBytes = chainOut.str();
+    std::vector<SharedPtr<GraphNode>> chainLoaded = loadGraph<GraphNode>(chainBytes.data(), chainBytes.size());
+    assert(chainLoaded.size() == 1 && chainLoaded[0].getCount() == 1);
+    int walked = 0;
+    for (GraphNode* node = chainLoaded[0].get(); node != nullptr; node = node->left.get()) {
+        assert(node->value == length - 1 - walked);
+        ++walked;
+    }
+    assert(walked == length);
+    //take both chains apart from the top, so destroying them does not recurse either
+    for (SharedPtr<GraphNode>* head : {&chain, &chainLoaded[0]}) {
+        while (head->get() != nullptr) {
+            SharedPtr<GraphNode> next = std::move((*head)->left);
+            *head = std::move(next);
+        }
+    }
+
+    //children passed as temporaries, two lists sharing their tail
+    {
+        CompactSharedPtr<CompactNode> tail = MakeCompactShared<CompactNode>(3);
+        tail->next = MakeCompactShared<CompactNode>(4);
+        SharedPtr<CompactNode> heads[2] = {MakeShared<CompactNode>(1), MakeShared<CompactNode>(2)};
+        for (SharedPtr<CompactNode>& head : heads) {
+            head->next = tail;
+        }
+        std::ostringstream compactOut;
+        saveGraph(compactOut, std::vector<SharedPtr<CompactNode>>{heads[0], heads[1]});
+        std::string compactBytes = compactOut.str();
+        std::vector<SharedPtr<CompactNode>> compactLoaded = loadGraph<CompactNode>(compactBytes.data(), compactBytes.size());
+        assert(compactLoaded.size() == 2);
+        assert(compactLoaded[0]->value == 1 && compactLoaded[1]->value == 2);
+        assert(compactLoaded[0]->next.get() == compactLoaded[1]->next.get());
+        assert(compactLoaded[0]->next->value == 3 && compactLoaded[0]->next->next->value == 4);
+        assert(compactLoaded[0]->next.getCount() == 2 && tail.getCount() == 3);
+    }
+
+    //cycles are refused
+    SharedPtr<GraphNode> first = MakeShared<GraphNode>(1, "");
+    first->left = MakeShared<GraphNode>(2, "");
+    first->left->right = first;
+    bool threw = false;
+    try {
+        std::ostringstream cycleOut;
+        saveGraph(cycleOut, std::vector<SharedPtr<GraphNode>>{first});
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+    first->left->right.reset();
+
+    //so is input that is cut short, mangled or not a graph at all
+    const std::string broken[] = {bytes.substr(0, bytes.size() - 1), bytes.substr(0, 20), "not a graph", std::string(bytes).replace(8, 1, 1, '\x7f')};
+    for (const std::string& input : broken) {
+        threw = false;
+        try {
+            loadGraph<GraphNode>(input.data(), input.size());
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+    std::cout << "testGraphSerializer passed!" << std::endl;
+}
+
+void testStdInterop() {
+    CountedObject::destroyed = 0;
+    //adopting a std::shared_ptr: the object lives until both sides let go
+    std::shared_ptr<CountedObject> stdSp = std::make_shared<CountedObject>(570);
+    SharedPtr<CountedObject> sp = SharedPtr<CountedObject>::fromStd(stdSp);
+    assert(sp.get() == stdSp.get());
+    assert(sp.getCount() == 1);
+    assert(stdSp.use_count() == 2);
+    stdSp.reset();
+    assert(CountedObject::destroyed == 0);
+    assert(sp->value == 570);
+    sp.reset();
+    assert(CountedObject::destroyed == 1);
+
+    //handing a SharedPtr out as a std::shared_ptr, copied and moved
+    SharedPtr<CountedObject> sp1 = MakeShared<CountedObject>(580);
+    std::shared_ptr<CountedObject> stdSp1 = sp1.toStd();
+    assert(stdSp1.get() == sp1.get());
+    assert(sp1.getCount() == 2);
+    assert(stdSp1.use_count() == 1);
+    std::shared_ptr<CountedObject> stdSp2 = SharedPtr<CountedObject>(sp1).toStd();
+    assert(sp1.getCount() == 3);
+    SharedPtr<CountedObject> moved = sp1;
+    std::shared_ptr<CountedObject> stdSp3 = std::move(moved).toStd();
+    assert(moved.get() == nullptr);
+    assert(sp1.getCount() == 4);
+    sp1.reset();
+    stdSp2.reset();
+    stdSp3.reset();
+    assert(CountedObject::destroyed == 1);
+    assert(stdSp1->value == 580);
+    stdSp1.reset();
+    assert(CountedObject::destroyed == 2);
+
+    //round trips hand back the original handle instead of wrapping it again, however often they are repeated
+    SharedPtr<CountedObject> origin = MakeShared<CountedObject>(590);
+    SharedPtr<CountedObject> back = SharedPtr<CountedObject>::fromStd(origin.toStd());
+    assert(back.get() == origin.get());
+    assert(origin.getCount() == 2);
+    std::shared_ptr<CountedObject> stdOrigin = std::make_shared<CountedObject>(600);
+    std::shared_ptr<CountedObject> stdBack = SharedPtr<CountedObject>::fromStd(stdOrigin).toStd();
+    assert(stdBack.get() == stdOrigin.get());
+    assert(!stdBack.owner_before(stdOrigin) && !stdOrigin.owner_before(stdBack));
+    assert(stdOrigin.use_count() == 2);
+    std::shared_ptr<CountedObject> bounced = stdOrigin;
+    for (int i = 0; i < 10; ++i) {
+        bounced = SharedPtr<CountedObject>::fromStd(std::move(bounced)).toStd();
+    }
+    assert(!bounced.owner_before(stdOrigin) && !stdOrigin.owner_before(bounced));
+    assert(stdOrigin.use_count() == 3);
+    SharedPtr<CountedObject> adopted = SharedPtr<CountedObject>::fromStd(stdOrigin);
+    for (int i = 0; i < 10; ++i) {
+        adopted = SharedPtr<CountedObject>::fromStd(adopted.toStd());
+    }
+    assert(adopted.getCount() == 1);
+    assert(stdOrigin.use_count() == 4);
+    back.reset();
+    origin.reset();
+    assert(CountedObject::destroyed == 3);
+    stdOrigin.reset();
+    stdBack.reset();
+    bounced.reset();
+    assert(CountedObject::destroyed == 3);
+    adopted.reset();
+    assert(CountedObject::destroyed == 4);
+
+    //aliasing handles keep pointing at the member on either side
+    std::shared_ptr<Buffer> stdBuffer = std::make_shared<Buffer>(610);
+    SharedPtr<int> header = SharedPtr<int>::fromStd(std::shared_ptr<int>(stdBuffer, &stdBuffer->header));
+    stdBuffer.reset();
+    assert(*header == 610);
+    std::shared_ptr<int> stdHeader = header.toStd();
+    header.reset();
+    assert(*stdHeader == 610);
+    assert(stdHeader.use_count() == 1);
+
+    //empty handles stay empty, pooled control blocks work both ways
+    assert(SharedPtr<CountedObject>::fromStd(std::shared_ptr<CountedObject>()).get() == nullptr);
+    assert(SharedPtr<CountedObject>().toStd() == nullptr);
+    TestObject::deleted = false;
+    SharedPtr<PooledTestObject> pooled = SharedPtr<PooledTestObject>::fromStd(std::make_shared<PooledTestObject>(620));
+    std::shared_ptr<PooledTestObject> stdPooled = MakeShared<PooledTestObject>(630).toStd();
+    assert(pooled->value == 620 && stdPooled->value == 630);
+    pooled.reset();
+    assert(TestObject::deleted);
+    TestObject::deleted = false;
+    //the last std owner may be on another thread
+    std::thread releaser([moved = std::move(stdPooled)]() mutable {
+        moved.reset();
+    });
+    releaser.join();
+    assert(TestObject::deleted);
+    std::cout << "testStdInterop passed!" << std::endl;
+}
+
+void testAssignFromReleasedObject() {
+    ListNode::destroyed = 0;
+    SharedPtr<ListNode> head = MakeShared<ListNode>(0);
+    SharedPtr<ListNode> tail = head;
+    for (int i = 1; i < 8; ++i) {
+        tail->next = MakeShared<ListNode>(i);
+        tail = tail->next;
+    }
+    tail.reset();
+    //copy assignment: each step releases the node that holds the handle being copied
+    for (int i = 0; i < 4; ++i) {
+        assert(head->value == i);
+        assert(head.getCount() == 1);
+        head = head->next;
+    }
+    assert(ListNode::destroyed == 4);
+    //move assignment: the same, stealing the handle out of the node about to go
+    for (int i = 4; i < 8; ++i) {
+        assert(head->value == i);
+        head = std::move(head->next);
+    }
+    assert(head.get() == nullptr);
+    assert(ListNode::destroyed == 8);
+
+    //self assignment keeps the object, with either operator
+    SharedPtr<ListNode> self = MakeShared<ListNode>(10);
+    SharedPtr<ListNode>& alias = self;
+    self = alias;
+    assert(self.getCount() == 1 && self->value == 10);
+    self = std::move(alias);
+    assert(self.getCount() == 1 && self->value == 10);
+    std::cout << "testAssignFromReleasedObject passed!" << std::endl;
+}
+
+void testWeakAssignFromReleasedObject() {
+    CountedObject::destroyed = 0;
+    WeakHolder::destroyed = 0;
+    SharedPtr<CountedObject> target = MakeShared<CountedObject>(640);
+    for (int form = 0; form < 3; ++form) {
+        SharedPtr<WeakHolder> holder = MakeShared<WeakHolder>();
+        holder->observer = target;
+        WeakHolder* raw = holder.get();
+        //the deleter's handle is now the holder's only owner
+        SharedPtr<CountedObject> kept(new CountedObject(650), [keep = std::move(holder)](CountedObject* object) {
+            delete object;
+        });
+        WeakPtr<CountedObject> weak(kept);
+        kept.reset();
+        assert(weak.expired());
+        assert(WeakHolder::destroyed == form);
+        //dropping weak's reference frees the block, its deleter and with it the holder that owns the source
+        if (form == 0) {
+            weak = raw->observer;
+        } else if (form == 1) {
+            weak = std::move(raw->observer);
+        } else {
+            weak = raw->observer.lock();
+        }
+        assert(WeakHolder::destroyed == form + 1);
+        assert(weak.lock().get() == target.get());
+    }
+    assert(CountedObject::destroyed == 3);
+    std::cout << "testWeakAssignFromReleasedObject passed!" << std::endl;
+}
+
 int main() {
     testDefaultConstructor();
     testConstructorWithPointer();
@@ -490,6 +3127,43 @@ int main() {
     testConcurrentCopyAndAssignment();
     testLargeNumberOfThreads();
     testScopeDeletionWithThreads();
+    testMakeShared();
+    testEmptyHandles();
+    testAtomicLoadStoreExchange();
+    testAtomicCompareExchange();
+    testAtomicConcurrentReadersAndWriters();
+    testWeakPtr();
+    testWeakPtrOutlivesMakeShared();
+    testConcurrentWeakLock();
+    testPooledControlBlocks();
+    testSingleThreadedPolicy();
+    testShardedPolicy();
+    testShardedCrossThreadRelease();
+    testShardedSharedShardRelease();
+    testBiasedPolicy();
+    testBiasedHandOver();
+    testDeferredDestruction();
+    testBackgroundReclaimer();
+    testRefCountStats();
+    testCustomDeleter();
+    testAllocateShared();
+    testAliasing();
+    testPointerCasts();
+    testSharedArray();
+    testMakeSharedForOverwrite();
+    testIntrusive();
+    testEnableSharedFromThis();
+    testCompactSharedPtr();
+    testBorrowed();
+    testReleaseBatching();
+    testSharedPtrQueue();
+    testSharedCache();
+    testSnapshotPublisher();
+    testRecyclingPool();
+    testGraphSerializer();
+    testStdInterop();
+    testAssignFromReleasedObject();
+    testWeakAssignFromReleasedObject();
 
     std::cout << "All tests passed!" << std::endl;
     return 0;
@@ -0,0 +1,443 @@
+#include "SharedPtr.h"
+#include "CompactSharedPtr.h"
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+/* Per-operation costs of SharedPtr and std::shared_ptr side by side, written as JSON Lines on stdout so results can be
+* stored and compared between builds to gate regressions. Every record is one line, either a size:
+*   {"sizeof":"handle","impl":"SharedPtr","object_bytes":8,"bytes":16}
+* or a timing:
+*   {"benchmark":"copy","impl":"SharedPtr","threads":1,"contended":false,"object_bytes":8,"ns_per_op":1.5,"allocs_per_op":0}
+*
+* The following operations are covered:
+* 1. construct (adopting new T), make (MakeShared / std::make_shared), copy, release (dropping a copy), move, get,
+*    reset (to a new T), destroy (dropping the last owner) and alias (a handle to a member sharing the owner's
+*    count), on one thread for several object sizes
+* 2. copy_release pairs on 1 to N threads, each thread on its own object (uncontended) or all on one (contended)
+* 3. scan, summing a field through a large array of handles, SharedPtr and std::shared_ptr against CompactSharedPtr
+*
+* Usage: microbenchmark [--quick] [--max-threads N]
+*   --quick        small batches and few rounds, a smoke test rather than a measurement
+*   --max-threads  upper end of the thread sweep, defaults to max(4, hardware threads)
+*/
+
+//every allocation made through the global operator new on the current thread, for allocations/op
+static thread_local std::size_t allocationCount = 0;
+
+/* Every form of the global operator new is replaced, the aligned ones (MakeSharedArray, over-aligned objects) and the
+* nothrow ones included, so none of them escapes the count. The array forms forward to these by default. Each delete
+* frees with the function matching its new.
+*/
+static void* countedAllocation(std::size_t size) noexcept {
+    ++allocationCount;
+    return std::malloc(size != 0 ? size : 1);
+}
+static void* countedAlignedAllocation(std::size_t size, std::align_val_t alignment) noexcept {
+    ++allocationCount;
+    std::size_t align = static_cast<std::size_t>(alignment);
+#if defined(_MSC_VER)
+    return _aligned_malloc(size != 0 ? size : 1, align);
+#else
+    //aligned_alloc wants the size to be a non-zero multiple of the alignment
+    std::size_t rounded = (size + align - 1) / align * align;
+    return std::aligned_alloc(align, rounded != 0 ? rounded : align);
+#endif
+}
+/* Out of line, or GCC inlines a delete into a caller whose operator new call it cannot see into (the one of a new
+* expression) and reports the free() as a mismatched deallocation.
+*/
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void release(void* ptr) noexcept {
+    std::free(ptr);
+}
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+static void alignedRelease(void* ptr) noexcept {
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void* operator new(std::size_t size) {
+    if (void* ptr = countedAllocation(size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (void* ptr = countedAlignedAllocation(size, alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlignedAllocation(size, alignment);
+}
+void operator delete(void* ptr) noexcept {
+    release(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept {
+    release(ptr);
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    release(ptr);
+}
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    alignedRelease(ptr);
+}
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    alignedRelease(ptr);
+}
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    alignedRelease(ptr);
+}
+
+//keep the compiler from discarding a value that is only computed for the benchmark
+template <typename V>
+inline void keep(const V& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+struct Options {
+    bool quick;
+    unsigned int maxThreads;
+};
+
+//a managed object of exactly Bytes bytes
+template <std::size_t Bytes>
+struct Payload {
+    int value;
+    unsigned char padding[Bytes - sizeof(int)];
+    explicit Payload(int value) : value(value) {}
+};
+
+struct Custom {
+    static const char* name() {
+        return "SharedPtr";
+    }
+    template <typename T>
+    using Ptr = SharedPtr<T>;
+    template <typename T>
+    static Ptr<T> make(int value) {
+        return MakeShared<T>(value);
+    }
+};
+
+//only used by the scan, CompactSharedPtr cannot adopt a pointer
+struct Compact {
+    static const char* name() {
+        return "CompactSharedPtr";
+    }
+    template <typename T>
+    using Ptr = CompactSharedPtr<T>;
+    template <typename T>
+    static Ptr<T> make(int value) {
+        return MakeCompactShared<T>(value);
+    }
+};
+
+struct Standard {
+    static const char* name() {
+        return "std::shared_ptr";
+    }
+    template <typename T>
+    using Ptr = std::shared_ptr<T>;
+    template <typename T>
+    static Ptr<T> make(int value) {
+        return std::make_shared<T>(value);
+    }
+};
+
+//records the size of the single allocation std::shared_ptr makes for its control block
+template <typename T>
+struct RecordingAllocator {
+    typedef T value_type;
+    std::size_t* bytes;
+
+    explicit RecordingAllocator(std::size_t* bytes) : bytes(bytes) {}
+    template <typename U>
+    RecordingAllocator(const RecordingAllocator<U>& other) : bytes(other.bytes) {}
+
+    T* allocate(std::size_t n) {
+        *this->bytes = n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* ptr, std::size_t n) {
+        std::allocator<T>().deallocate(ptr, n);
+    }
+    template <typename U>
+    bool operator==(const RecordingAllocator<U>& other) const {
+        return this->bytes == other.bytes;
+    }
+    template <typename U>
+    bool operator!=(const RecordingAllocator<U>& other) const {
+        return this->bytes != other.bytes;
+    }
+};
+
+struct Measurement {
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+//time ops operations done by workload on the calling thread
+template <typename F>
+Measurement measure(std::size_t ops, F&& workload) {
+    std::size_t allocationsBefore = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    workload();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return Measurement{elapsed.count() / ops, static_cast<double>(allocationCount - allocationsBefore) / ops};
+}
+
+//fastest of several rounds, the one least disturbed by the rest of the system
+class Best {
+    private:
+        Measurement best;
+        bool any;
+    public:
+        Best() : best{0, 0}, any(false) {}
+        void add(const Measurement& measurement) {
+            if (!this->any || measurement.nsPerOp < this->best.nsPerOp) {
+                this->best = measurement;
+                this->any = true;
+            }
+        }
+        const Measurement& get() const {
+            return this->best;
+        }
+};
+
+void emitTiming(const char* benchmark, const char* impl, unsigned int threads, bool contended, std::size_t objectBytes, const Measurement& measurement) {
+    std::cout << "{\"benchmark\":\"" << benchmark << "\",\"impl\":\"" << impl << "\",\"threads\":" << threads
+              << ",\"contended\":" << (contended ? "true" : "false") << ",\"object_bytes\":" << objectBytes
+              << ",\"ns_per_op\":" << measurement.nsPerOp << ",\"allocs_per_op\":" << measurement.allocsPerOp << "}" << std::endl;
+}
+
+void emitSize(const char* what, const char* impl, std::size_t objectBytes, std::size_t bytes) {
+    std::cout << "{\"sizeof\":\"" << what << "\",\"impl\":\"" << impl << "\",\"object_bytes\":" << objectBytes
+              << ",\"bytes\":" << bytes << "}" << std::endl;
+}
+
+template <std::size_t Bytes>
+void reportSizes() {
+    typedef Payload<Bytes> T;
+    emitSize("handle", Custom::name(), Bytes, sizeof(SharedPtr<T>));
+    emitSize("handle", Standard::name(), Bytes, sizeof(std::shared_ptr<T>));
+    emitSize("handle", Compact::name(), Bytes, sizeof(CompactSharedPtr<T>));
+    emitSize("pointer_block", Custom::name(), Bytes, sizeof(detail::PointerBlock<T, MultiThreaded>));
+    emitSize("inplace_block", Custom::name(), Bytes, sizeof(detail::InplaceBlock<T, MultiThreaded>));
+
+    std::size_t bytes = 0;
+    {
+        std::shared_ptr<T> adopted(new T(0), std::default_delete<T>(), RecordingAllocator<T>(&bytes));
+    }
+    emitSize("pointer_block", Standard::name(), Bytes, bytes);
+    {
+        std::shared_ptr<T> made = std::allocate_shared<T>(RecordingAllocator<T>(&bytes), 0);
+    }
+    emitSize("inplace_block", Standard::name(), Bytes, bytes);
+}
+
+template <typename Impl, std::size_t Bytes>
+void singleThreadOps(const Options& options) {
+    typedef Payload<Bytes> T;
+    typedef typename Impl::template Ptr<T> Ptr;
+    const std::size_t batch = options.quick ? 256 : 4096;
+    const int rounds = options.quick ? 3 : 25;
+    Best construct, make, copy, release, move, get, reset, destroy, alias;
+    for (int round = 0; round < rounds; ++round) {
+        std::vector<Ptr> owners;
+        owners.reserve(batch);
+        construct.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                owners.emplace_back(new T(static_cast<int>(i)));
+            }
+        }));
+
+        std::vector<Ptr> copies;
+        copies.reserve(batch);
+        copy.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                copies.emplace_back(owners[i]);
+            }
+        }));
+        release.add(measure(batch, [&] {
+            copies.clear();
+        }));
+
+        std::vector<typename Impl::template Ptr<int>> members;
+        members.reserve(batch);
+        alias.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                members.emplace_back(owners[i], &owners[i]->value);
+            }
+        }));
+        members.clear();
+
+        std::vector<Ptr> moved;
+        moved.reserve(batch);
+        move.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                moved.emplace_back(std::move(owners[i]));
+            }
+        }));
+
+        long sum = 0;
+        get.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                sum += moved[i].get()->value;
+            }
+        }));
+        keep(sum);
+
+        reset.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                moved[i].reset(new T(static_cast<int>(i)));
+            }
+        }));
+        destroy.add(measure(batch, [&] {
+            moved.clear();
+        }));
+
+        std::vector<Ptr> made;
+        made.reserve(batch);
+        make.add(measure(batch, [&] {
+            for (std::size_t i = 0; i < batch; ++i) {
+                made.emplace_back(Impl::template make<T>(static_cast<int>(i)));
+            }
+        }));
+    }
+    emitTiming("construct", Impl::name(), 1, false, Bytes, construct.get());
+    emitTiming("make", Impl::name(), 1, false, Bytes, make.get());
+    emitTiming("copy", Impl::name(), 1, false, Bytes, copy.get());
+    emitTiming("release", Impl::name(), 1, false, Bytes, release.get());
+    emitTiming("move", Impl::name(), 1, false, Bytes, move.get());
+    emitTiming("get", Impl::name(), 1, false, Bytes, get.get());
+    emitTiming("reset", Impl::name(), 1, false, Bytes, reset.get());
+    emitTiming("destroy", Impl::name(), 1, false, Bytes, destroy.get());
+    emitTiming("alias", Impl::name(), 1, false, Bytes, alias.get());
+}
+
+//every thread copies and drops a handle in a loop, either to its own object or all to the same one
+template <typename Impl>
+void threadedCopies(const Options& options, unsigned int numThreads, bool contended) {
+    typedef Payload<8> T;
+    typedef typename Impl::template Ptr<T> Ptr;
+    const std::size_t iterations = options.quick ? (1 << 12) : (1 << 21);
+    Ptr shared = Impl::template make<T>(1);
+    std::atomic<unsigned int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<Measurement> results(numThreads);
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            Ptr own = contended ? shared : Impl::template make<T>(1);
+            ++ready;
+            //start together, so the threads really overlap
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            results[t] = measure(iterations, [&] {
+                for (std::size_t i = 0; i < iterations; ++i) {
+                    Ptr copy(own);
+                    keep(copy.get());
+                }
+            });
+        });
+    }
+    while (ready.load() < numThreads) {
+        std::this_thread::yield();
+    }
+    go = true;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    Measurement average{0, 0};
+    for (const Measurement& result : results) {
+        average.nsPerOp += result.nsPerOp / numThreads;
+        average.allocsPerOp += result.allocsPerOp / numThreads;
+    }
+    emitTiming("copy_release", Impl::name(), numThreads, contended, sizeof(T), average);
+}
+
+//read one field of every object through an array of handles, the objects allocated in order so handle density dominates
+template <typename Impl>
+void handleScan(const Options& options) {
+    typedef Payload<8> T;
+    typedef typename Impl::template Ptr<T> Ptr;
+    const std::size_t count = options.quick ? (1 << 12) : (1 << 20);
+    const int rounds = options.quick ? 3 : 10;
+    std::vector<Ptr> handles;
+    handles.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        handles.emplace_back(Impl::template make<T>(static_cast<int>(i)));
+    }
+    Best scan;
+    for (int round = 0; round < rounds; ++round) {
+        long sum = 0;
+        scan.add(measure(count, [&] {
+            for (const Ptr& handle : handles) {
+                sum += handle->value;
+            }
+        }));
+        keep(sum);
+    }
+    emitTiming("scan", Impl::name(), 1, false, sizeof(T), scan.get());
+}
+
+template <typename Impl>
+void runAll(const Options& options) {
+    singleThreadOps<Impl, 8>(options);
+    singleThreadOps<Impl, 64>(options);
+    singleThreadOps<Impl, 1024>(options);
+    for (unsigned int threads = 1; threads <= options.maxThreads; threads *= 2) {
+        threadedCopies<Impl>(options, threads, false);
+        threadedCopies<Impl>(options, threads, true);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options{false, std::max(4u, std::thread::hardware_concurrency())};
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            options.quick = true;
+        } else if (std::strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            options.maxThreads = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--quick] [--max-threads N]" << std::endl;
+            return 2;
+        }
+    }
+
+    reportSizes<8>();
+    reportSizes<64>();
+    reportSizes<1024>();
+    runAll<Custom>(options);
+    runAll<Standard>(options);
+    handleScan<Custom>(options);
+    handleScan<Compact>(options);
+    handleScan<Standard>(options);
+    return 0;
+}